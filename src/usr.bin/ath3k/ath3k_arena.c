@@ -0,0 +1,118 @@
+/*-
+ * Copyright (c) 2013 Adrian Chadd <adrian@freebsd.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer,
+ *    without modification.
+ * 2. Redistributions in binary form must reproduce at minimum a disclaimer
+ *    similar to the "NO WARRANTY" disclaimer below ("Disclaimer") and any
+ *    redistribution must be conditioned upon including a substantially
+ *    similar Disclaimer requirement for further binary redistribution.
+ *
+ * NO WARRANTY
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF NONINFRINGEMENT, MERCHANTIBILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGES.
+ *
+ * $FreeBSD$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+
+#include "ath3k_arena.h"
+#include "ath3k_dbg.h"
+
+struct ath3k_arena ath3k_arena;
+
+/*
+ * Allocate the arena.  This is the only allocation the image
+ * buffers need; call it before anything is loaded.
+ *
+ * Returns 1 on success, 0 on error.
+ */
+int
+ath3k_arena_init(size_t size)
+{
+
+	ath3k_arena.base = malloc(size);
+	if (ath3k_arena.base == NULL) {
+		warn("%s: malloc", __func__);
+		return (0);
+	}
+	ath3k_arena.size = size;
+	ath3k_arena.used = 0;
+	ath3k_arena.high = 0;
+	ath3k_arena.live = 0;
+	return (1);
+}
+
+/*
+ * Returns zeroed space for len bytes, or NULL if there's no arena
+ * or it's full.
+ */
+void *
+ath3k_arena_alloc(size_t len)
+{
+	unsigned char *p;
+	size_t alen;
+
+	if (ath3k_arena.base == NULL)
+		return (NULL);
+
+	alen = (len + ATH3K_ARENA_ALIGN - 1) &
+	    ~(size_t) (ATH3K_ARENA_ALIGN - 1);
+	if (alen > ath3k_arena.size - ath3k_arena.used) {
+		ath3k_debug("%s: %zu bytes won't fit (%zu of %zu used)\n",
+		    __func__,
+		    len,
+		    ath3k_arena.used,
+		    ath3k_arena.size);
+		return (NULL);
+	}
+
+	p = ath3k_arena.base + ath3k_arena.used;
+	ath3k_arena.used += alen;
+	if (ath3k_arena.used > ath3k_arena.high)
+		ath3k_arena.high = ath3k_arena.used;
+	ath3k_arena.live++;
+	memset(p, 0, len);
+	return (p);
+}
+
+int
+ath3k_arena_owns(const void *p)
+{
+	const unsigned char *c = p;
+
+	return (ath3k_arena.base != NULL && c >= ath3k_arena.base &&
+	    c < ath3k_arena.base + ath3k_arena.size);
+}
+
+/*
+ * Release a buffer; the space comes back once nothing in the arena
+ * is live.
+ */
+void
+ath3k_arena_release(const void *p)
+{
+
+	if (! ath3k_arena_owns(p) || ath3k_arena.live == 0)
+		return;
+	if (--ath3k_arena.live == 0)
+		ath3k_arena.used = 0;
+}
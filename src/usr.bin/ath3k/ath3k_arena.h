@@ -0,0 +1,60 @@
+/*-
+ * Copyright (c) 2013 Adrian Chadd <adrian@freebsd.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer,
+ *    without modification.
+ * 2. Redistributions in binary form must reproduce at minimum a disclaimer
+ *    similar to the "NO WARRANTY" disclaimer below ("Disclaimer") and any
+ *    redistribution must be conditioned upon including a substantially
+ *    similar Disclaimer requirement for further binary redistribution.
+ *
+ * NO WARRANTY
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF NONINFRINGEMENT, MERCHANTIBILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGES.
+ *
+ * $FreeBSD$
+ */
+#ifndef	__ATH3K_ARENA_H__
+#define	__ATH3K_ARENA_H__
+
+/*
+ * The firmware images are carved out of a single arena that's
+ * allocated once at startup, so the load itself doesn't go near
+ * malloc().  It's a bump allocator: space is handed back when the
+ * last live buffer is released.  Anything that doesn't fit falls
+ * back to the heap and is counted in ath3k_heap_allocs_total.
+ */
+
+#define	ATH3K_ARENA_SIZE		(1024 * 1024)
+#define	ATH3K_ARENA_ALIGN		16
+
+struct ath3k_arena {
+	unsigned char	*base;
+	size_t		size;
+	size_t		used;
+	size_t		high;		/* high water mark */
+	int		live;		/* buffers not yet released */
+};
+
+extern	struct ath3k_arena ath3k_arena;
+
+extern	int ath3k_arena_init(size_t size);
+extern	void *ath3k_arena_alloc(size_t len);
+extern	int ath3k_arena_owns(const void *p);
+extern	void ath3k_arena_release(const void *p);
+
+#endif
@@ -0,0 +1,168 @@
+/*-
+ * Copyright (c) 2013 Adrian Chadd <adrian@freebsd.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer,
+ *    without modification.
+ * 2. Redistributions in binary form must reproduce at minimum a disclaimer
+ *    similar to the "NO WARRANTY" disclaimer below ("Disclaimer") and any
+ *    redistribution must be conditioned upon including a substantially
+ *    similar Disclaimer requirement for further binary redistribution.
+ *
+ * NO WARRANTY
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF NONINFRINGEMENT, MERCHANTIBILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGES.
+ *
+ * $FreeBSD$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <err.h>
+#include <fcntl.h>
+#include <sys/file.h>
+
+#include "ath3k_bdaddr.h"
+#include "ath3k_dbg.h"
+
+#define	ATH3K_BDADDR_MAX	0xffffffffffffULL
+
+static uint64_t
+ath3k_bdaddr_to64(const uint8_t *addr)
+{
+	uint64_t v = 0;
+	int i;
+
+	for (i = 0; i < ATH3K_BDADDR_LEN; i++)
+		v = (v << 8) | addr[i];
+	return (v);
+}
+
+static void
+ath3k_bdaddr_from64(uint64_t v, uint8_t *addr)
+{
+	int i;
+
+	for (i = ATH3K_BDADDR_LEN - 1; i >= 0; i--) {
+		addr[i] = v & 0xff;
+		v >>= 8;
+	}
+}
+
+/*
+ * Parse "xx:xx:xx:xx:xx:xx" into addr, most significant byte first.
+ *
+ * Returns the number of characters consumed, or -1 on error.
+ */
+int
+ath3k_bdaddr_parse(const char *str, uint8_t *addr)
+{
+	unsigned int b[ATH3K_BDADDR_LEN];
+	int i, n;
+
+	if (sscanf(str, "%2x:%2x:%2x:%2x:%2x:%2x%n",
+	    &b[0], &b[1], &b[2], &b[3], &b[4], &b[5], &n) != 6)
+		return (-1);
+
+	for (i = 0; i < ATH3K_BDADDR_LEN; i++)
+		addr[i] = b[i];
+	return (n);
+}
+
+/*
+ * Hand out the next address from the state file.
+ *
+ * Returns 1 on success, 0 on error (including running out).
+ */
+int
+ath3k_bdaddr_alloc(const char *statefile, uint8_t *addr)
+{
+	uint8_t last[ATH3K_BDADDR_LEN];
+	char buf[128];
+	uint64_t next, end = ATH3K_BDADDR_MAX;
+	ssize_t r;
+	int fd, n, ret = 0;
+
+	fd = open(statefile, O_RDWR);
+	if (fd < 0) {
+		warn("%s: open: %s", __func__, statefile);
+		return (0);
+	}
+
+	/* Serialise against other ath3kfw instances */
+	if (flock(fd, LOCK_EX) != 0) {
+		warn("%s: flock: %s", __func__, statefile);
+		close(fd);
+		return (0);
+	}
+
+	r = pread(fd, buf, sizeof(buf) - 1, 0);
+	if (r < 0) {
+		warn("%s: read: %s", __func__, statefile);
+		goto done;
+	}
+	buf[r] = '\0';
+
+	n = ath3k_bdaddr_parse(buf, addr);
+	if (n < 0) {
+		ath3k_err("%s: %s: bad state\n", __func__, statefile);
+		goto done;
+	}
+	if (ath3k_bdaddr_parse(buf + n + strspn(buf + n, " \t"), last) > 0)
+		end = ath3k_bdaddr_to64(last);
+
+	/*
+	 * The high water mark written back is next + 1, which doesn't
+	 * fit for the very last address; rather than wrap back to zero,
+	 * ff:ff:ff:ff:ff:ff is never handed out and marks the range as
+	 * used up.
+	 */
+	next = ath3k_bdaddr_to64(addr);
+	if (next > end || next == ATH3K_BDADDR_MAX) {
+		ath3k_err("%s: %s: address range exhausted\n",
+		    __func__,
+		    statefile);
+		goto done;
+	}
+
+	/* Write back the new high water mark before handing this out */
+	ath3k_bdaddr_from64(next + 1, last);
+	n = snprintf(buf, sizeof(buf), "%02x:%02x:%02x:%02x:%02x:%02x",
+	    last[0], last[1], last[2], last[3], last[4], last[5]);
+	if (end != ATH3K_BDADDR_MAX) {
+		ath3k_bdaddr_from64(end, last);
+		n += snprintf(buf + n, sizeof(buf) - n,
+		    " %02x:%02x:%02x:%02x:%02x:%02x",
+		    last[0], last[1], last[2], last[3], last[4], last[5]);
+	}
+	n += snprintf(buf + n, sizeof(buf) - n, "\n");
+
+	if (pwrite(fd, buf, n, 0) != n || ftruncate(fd, n) != 0 ||
+	    fsync(fd) != 0) {
+		warn("%s: write: %s", __func__, statefile);
+		goto done;
+	}
+
+	ret = 1;
+
+done:
+	flock(fd, LOCK_UN);
+	close(fd);
+	return (ret);
+}
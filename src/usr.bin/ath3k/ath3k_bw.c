@@ -0,0 +1,120 @@
+/*-
+ * Copyright (c) 2013 Adrian Chadd <adrian@freebsd.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer,
+ *    without modification.
+ * 2. Redistributions in binary form must reproduce at minimum a disclaimer
+ *    similar to the "NO WARRANTY" disclaimer below ("Disclaimer") and any
+ *    redistribution must be conditioned upon including a substantially
+ *    similar Disclaimer requirement for further binary redistribution.
+ *
+ * NO WARRANTY
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF NONINFRINGEMENT, MERCHANTIBILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGES.
+ *
+ * $FreeBSD$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+
+#include <libusb.h>
+
+#include "ath3k_fw.h"
+#include "ath3k_bw.h"
+#include "ath3k_hw.h"
+#include "ath3k_dbg.h"
+#include "ath3k_time.h"
+
+static struct ath3k_bw ath3k_bw;
+
+void
+ath3k_bw_init(uint64_t rate, uint64_t burst)
+{
+
+	bzero(&ath3k_bw, sizeof(ath3k_bw));
+	if (rate == 0)
+		return;
+
+	/* The bucket has to hold at least one full chunk */
+	if (burst < BULK_SIZE)
+		burst = BULK_SIZE;
+
+	ath3k_bw.rate = rate;
+	ath3k_bw.burst = burst;
+	ath3k_bw.tokens = burst;
+	ath3k_bw.last = ath3k_time_usec();
+
+	ath3k_debug("%s: rate=%llu bytes/s, burst=%llu bytes\n",
+	    __func__,
+	    (unsigned long long) rate,
+	    (unsigned long long) burst);
+}
+
+static void
+ath3k_bw_refill(uint64_t now)
+{
+	uint64_t add;
+
+	add = (now - ath3k_bw.last) * ath3k_bw.rate / 1000000ULL;
+	if (add == 0)
+		return;
+
+	ath3k_bw.tokens += add;
+	if (ath3k_bw.tokens > ath3k_bw.burst)
+		ath3k_bw.tokens = ath3k_bw.burst;
+	ath3k_bw.last = now;
+}
+
+/*
+ * How long until there are enough tokens to send 'bytes', in usec;
+ * 0 if it can go now.  This doesn't block, so the caller can keep
+ * servicing the transfers it has in flight whilst it waits.
+ */
+uint64_t
+ath3k_bw_delay(int bytes)
+{
+	uint64_t need;
+
+	if (ath3k_bw.rate == 0)
+		return (0);
+
+	ath3k_bw_refill(ath3k_time_usec());
+	if (ath3k_bw.tokens >= (uint64_t) bytes)
+		return (0);
+	need = (uint64_t) bytes - ath3k_bw.tokens;
+	return (need * 1000000ULL / ath3k_bw.rate + 1);
+}
+
+/*
+ * Consume the tokens for 'bytes', once ath3k_bw_delay() says
+ * they're there.
+ */
+void
+ath3k_bw_take(int bytes)
+{
+
+	if (ath3k_bw.rate == 0)
+		return;
+	if (ath3k_bw.tokens < (uint64_t) bytes)
+		ath3k_bw.tokens = 0;
+	else
+		ath3k_bw.tokens -= bytes;
+}
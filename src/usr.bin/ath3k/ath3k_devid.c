@@ -0,0 +1,126 @@
+/*-
+ * Copyright (c) 2013 Adrian Chadd <adrian@freebsd.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer,
+ *    without modification.
+ * 2. Redistributions in binary form must reproduce at minimum a disclaimer
+ *    similar to the "NO WARRANTY" disclaimer below ("Disclaimer") and any
+ *    redistribution must be conditioned upon including a substantially
+ *    similar Disclaimer requirement for further binary redistribution.
+ *
+ * NO WARRANTY
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF NONINFRINGEMENT, MERCHANTIBILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGES.
+ *
+ * $FreeBSD$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <err.h>
+
+#include "ath3k_devid.h"
+#include "ath3k_devids.h"
+#include "ath3k_dbg.h"
+
+static struct ath3k_devid ath3k_devid_extra[ATH3K_DEVID_MAX_EXTRA];
+static int ath3k_devid_nextra = 0;
+
+/*
+ * Look up a vendor/product ID.
+ *
+ * Returns 1 if it's an AR3012, 0 if it's known not to be, or -1 if
+ * it's not in either list.
+ */
+int
+ath3k_devid_lookup(uint16_t vendor_id, uint16_t product_id)
+{
+	const struct ath3k_devid *d;
+	uint32_t key;
+	int i;
+
+	for (i = 0; i < ath3k_devid_nextra; i++) {
+		d = &ath3k_devid_extra[i];
+		if (d->vendor_id == vendor_id && d->product_id == product_id)
+			return (d->is_3012);
+	}
+
+	key = ((uint32_t) vendor_id << 16) | product_id;
+	d = &ath3k_devid_hash[(uint32_t) (key * ATH3K_DEVID_HASH_MULT) >>
+	    (32 - ATH3K_DEVID_HASH_BITS)];
+	if (d->vendor_id == vendor_id && d->product_id == product_id)
+		return (d->is_3012);
+
+	return (-1);
+}
+
+/*
+ * Load extra IDs from a file; "vendor product is_3012" per line,
+ * with '#' comments - the same format as ath3k_devids.txt.
+ *
+ * Returns 1 if OK, 0 on error.
+ */
+int
+ath3k_devid_load(const char *file)
+{
+	FILE *fp;
+	char buf[128], *p;
+	unsigned int vid, pid;
+	int is_3012, line = 0, ret = 1;
+
+	fp = fopen(file, "r");
+	if (fp == NULL) {
+		warn("%s: fopen: %s", __func__, file);
+		return (0);
+	}
+
+	while (fgets(buf, sizeof(buf), fp) != NULL) {
+		line++;
+		if ((p = strchr(buf, '#')) != NULL)
+			*p = '\0';
+		p = buf + strspn(buf, " \t\r\n");
+		if (*p == '\0')
+			continue;
+
+		if (sscanf(p, "%x %x %d", &vid, &pid, &is_3012) != 3 ||
+		    vid > 0xffff || pid > 0xffff) {
+			ath3k_err("%s: %s: line %d: expected "
+			    "'vendor product is_3012'\n",
+			    __func__, file, line);
+			ret = 0;
+			break;
+		}
+		if (ath3k_devid_nextra >= ATH3K_DEVID_MAX_EXTRA) {
+			ath3k_err("%s: %s: more than %d IDs\n",
+			    __func__, file, ATH3K_DEVID_MAX_EXTRA);
+			ret = 0;
+			break;
+		}
+
+		ath3k_devid_extra[ath3k_devid_nextra].vendor_id = vid;
+		ath3k_devid_extra[ath3k_devid_nextra].product_id = pid;
+		ath3k_devid_extra[ath3k_devid_nextra].is_3012 = !! is_3012;
+		ath3k_devid_nextra++;
+		ath3k_debug("%s: %04x:%04x is_3012=%d\n",
+		    __func__, vid, pid, !! is_3012);
+	}
+
+	fclose(fp);
+	return (ret);
+}
@@ -0,0 +1,112 @@
+#!/usr/bin/awk -f
+#
+# $FreeBSD$
+#
+# Generate ath3k_devids.h from ath3k_devids.txt: a collision free
+# (perfect) hash table of the known AR3012 vendor/product IDs.
+#
+# The hash is multiplicative: h = (key * mult mod 2^32) >> (32 - bits),
+# with key = vid << 16 | pid.  Odd multipliers are tried until one
+# maps every ID to its own slot; the table grows if nothing is found
+# after a while.  awk only has doubles, so the 32 bit multiply is
+# done in 16 bit halves to stay exact.
+#
+
+function hex(s,		i, c, v) {
+	v = 0;
+	s = tolower(s);
+	sub(/^0x/, "", s);
+	for (i = 1; i <= length(s); i++) {
+		c = index("0123456789abcdef", substr(s, i, 1));
+		if (c == 0) {
+			printf("%s:%d: bad hex value\n", FILENAME, FNR) \
+			    > "/dev/stderr";
+			exit(1);
+		}
+		v = v * 16 + c - 1;
+	}
+	return (v);
+}
+
+function mul32(a, b) {
+	return ((a * (b % 65536) + (a * int(b / 65536)) % 65536 * 65536) % \
+	    4294967296);
+}
+
+BEGIN {
+	n = 0;
+}
+
+/^[ \t]*(#|$)/ {
+	next;
+}
+
+{
+	if (NF != 3) {
+		printf("%s:%d: expected 'vendor product is_3012'\n",
+		    FILENAME, FNR) > "/dev/stderr";
+		exit(1);
+	}
+	vid[n] = hex($1);
+	pid[n] = hex($2);
+	key[n] = vid[n] * 65536 + pid[n];
+	is3012[n] = $3 + 0;
+	for (i = 0; i < n; i++) {
+		if (vid[i] == vid[n] && pid[i] == pid[n]) {
+			printf("%s:%d: duplicate id\n", FILENAME, FNR) \
+			    > "/dev/stderr";
+			exit(1);
+		}
+	}
+	n++;
+}
+
+END {
+	if (n == 0)
+		exit(1);
+
+	srand(3012);
+	for (bits = 1; 2 ^ bits < 2 * n; bits++)
+		;
+	for (found = 0; !found && bits <= 16; bits++) {
+		size = 2 ^ bits;
+		div = 2 ^ (32 - bits);
+		for (try = 0; !found && try < 4096; try++) {
+			mult = int(rand() * 2147483648) * 2 + 1;
+			split("", slot);
+			found = 1;
+			for (i = 0; i < n; i++) {
+				h = int(mul32(key[i], mult) / div);
+				if (h in slot) {
+					found = 0;
+					break;
+				}
+				slot[h] = i;
+			}
+		}
+	}
+	if (!found) {
+		print "ath3k_devids.awk: no perfect hash found" > "/dev/stderr";
+		exit(1);
+	}
+	bits--;
+
+	print "/*";
+	print " * Generated from ath3k_devids.txt by ath3k_devids.awk;";
+	print " * do not edit.";
+	print " */";
+	print "";
+	printf("#define\tATH3K_DEVID_HASH_BITS\t%d\n", bits);
+	printf("#define\tATH3K_DEVID_HASH_MULT\t0x%08xU\n", mult);
+	print "";
+	print "static const struct ath3k_devid " \
+	    "ath3k_devid_hash[1 << ATH3K_DEVID_HASH_BITS] = {";
+	for (h = 0; h < size; h++) {
+		if (!(h in slot))
+			continue;
+		i = slot[h];
+		printf("\t[%d] = { .vendor_id = 0x%04x, .product_id = 0x%04x, " \
+		    ".is_3012 = %d },\n", h, vid[i], pid[i], is3012[i]);
+	}
+	print "};";
+}
@@ -31,6 +31,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
@@ -40,6 +41,9 @@
 #include <sys/stat.h>
 
 #include "ath3k_fw.h"
+#include "ath3k_arena.h"
+#include "ath3k_metrics.h"
+#include "ath3k_pin.h"
 #include "ath3k_dbg.h"
 
 int
@@ -47,9 +51,7 @@ ath3k_fw_read(struct ath3k_firmware *fw, const char *fwname)
 {
 	int fd;
 	struct stat sb;
-	unsigned char *buf;
 	ssize_t r;
-	int i;
 
 	fd = open(fwname, O_RDONLY);
 	if (fd < 0) {
@@ -62,20 +64,19 @@ ath3k_fw_read(struct ath3k_firmware *fw, const char *fwname)
 		close(fd);
 		return (0);
 	}
-	
-	buf = calloc(1, sb.st_size);
-	if (buf == NULL) {
-		warn("%s: calloc", __func__);
+	ath3k_pin_touch(fd, &sb);
+
+	bzero(fw, sizeof(*fw));
+	if (ath3k_fw_alloc(fw, sb.st_size) == 0) {
 		close(fd);
 		return (0);
 	}
 
-	i = 0;
 	/* XXX handle partial reads */
-	r = read(fd, buf, sb.st_size);
+	r = read(fd, fw->buf, sb.st_size);
 	if (r < 0) {
 		warn("%s: read", __func__);
-		free(buf);
+		ath3k_fw_free(fw);
 		close(fd);
 		return (0);
 	}
@@ -85,19 +86,15 @@ ath3k_fw_read(struct ath3k_firmware *fw, const char *fwname)
 		    __func__,
 		    (int) r,
 		    (int) sb.st_size);
-		free(buf);
+		ath3k_fw_free(fw);
 		close(fd);
 		return (0);
 	}
 
 	/* We have everything, so! */
 
-	bzero(fw, sizeof(*fw));
-
-	fw->fwname = strdup(fwname);
+	snprintf(fw->fwname, sizeof(fw->fwname), "%s", fwname);
 	fw->len = sb.st_size;
-	fw->size = sb.st_size;
-	fw->buf = buf;
 
 	close(fd);
 	return (1);
@@ -106,9 +103,188 @@ ath3k_fw_read(struct ath3k_firmware *fw, const char *fwname)
 void
 ath3k_fw_free(struct ath3k_firmware *fw)
 {
-	if (fw->fwname)
-		free(fw->fwname);
-	if (fw->buf)
-		free(fw->buf);
+	if (fw->buf != NULL) {
+		if (ath3k_arena_owns(fw->buf))
+			ath3k_arena_release(fw->buf);
+		else
+			free(fw->buf);
+	}
 	bzero(fw, sizeof(*fw));
 }
+
+/*
+ * Give the image a zeroed buffer of the given size, from the arena
+ * if there's room.  The caller fills in len.
+ *
+ * Returns 1 on success, 0 on error.
+ */
+int
+ath3k_fw_alloc(struct ath3k_firmware *fw, int size)
+{
+
+	fw->buf = ath3k_arena_alloc(size);
+	if (fw->buf == NULL) {
+		fw->buf = calloc(1, size);
+		if (fw->buf == NULL) {
+			warn("%s: calloc", __func__);
+			return (0);
+		}
+		ath3k_counter_add(ATH3K_CTR_HEAP_ALLOCS, 1);
+	}
+	fw->size = size;
+	return (1);
+}
+
+/*
+ * Grow the image buffer to at least the given size, keeping the
+ * contents.
+ *
+ * Returns 1 on success, 0 on error (the old buffer is untouched).
+ */
+int
+ath3k_fw_grow(struct ath3k_firmware *fw, int size)
+{
+	struct ath3k_firmware n;
+
+	if (size <= fw->size)
+		return (1);
+
+	bzero(&n, sizeof(n));
+	if (ath3k_fw_alloc(&n, size) == 0)
+		return (0);
+	memcpy(n.buf, fw->buf, fw->len);
+	if (ath3k_arena_owns(fw->buf))
+		ath3k_arena_release(fw->buf);
+	else
+		free(fw->buf);
+	fw->buf = n.buf;
+	fw->size = n.size;
+	return (1);
+}
+
+/*
+ * Hint that the given firmware file will be read shortly, so the
+ * read can overlap with whatever the device is busy doing.
+ */
+void
+ath3k_fw_prefetch(const char *fwname)
+{
+	int fd;
+
+	fd = open(fwname, O_RDONLY);
+	if (fd < 0) {
+		ath3k_debug("%s: open: %s: %s\n",
+		    __func__,
+		    fwname,
+		    strerror(errno));
+		return;
+	}
+
+	(void) posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+	close(fd);
+}
+
+/*
+ * Write out a firmware image.  It's written to a temporary file made
+ * with mkstemp() next to fwname and renamed into place, so a failed
+ * write never leaves a truncated image behind and concurrent runs
+ * don't trample each other's (or follow a planted symlink).
+ */
+int
+ath3k_fw_write(const struct ath3k_firmware *fw, const char *fwname)
+{
+	char tmpname[FILENAME_MAX];
+	ssize_t r;
+	int fd;
+
+	if (snprintf(tmpname, sizeof(tmpname), "%s.XXXXXX", fwname) >=
+	    (int) sizeof(tmpname)) {
+		ath3k_err("%s: %s: path too long\n", __func__, fwname);
+		return (0);
+	}
+
+	fd = mkstemp(tmpname);
+	if (fd < 0) {
+		warn("%s: mkstemp: %s", __func__, tmpname);
+		return (0);
+	}
+	/* mkstemp() makes it 0600; images are world readable */
+	if (fchmod(fd, 0644) != 0) {
+		warn("%s: fchmod: %s", __func__, tmpname);
+		close(fd);
+		unlink(tmpname);
+		return (0);
+	}
+
+	r = write(fd, fw->buf, fw->len);
+	if (r != fw->len) {
+		warn("%s: write: %s", __func__, tmpname);
+		close(fd);
+		unlink(tmpname);
+		return (0);
+	}
+
+	if (close(fd) != 0 || rename(tmpname, fwname) != 0) {
+		warn("%s: %s", __func__, fwname);
+		unlink(tmpname);
+		return (0);
+	}
+
+	return (1);
+}
+
+/*
+ * Add an overlay replacing len bytes at off.
+ *
+ * Returns 1 on success, 0 on error.
+ */
+int
+ath3k_fw_overlay_add(struct ath3k_firmware *fw, int off,
+    const unsigned char *data, int len)
+{
+	struct ath3k_fw_overlay *o;
+
+	if (off < 0 || len <= 0 || off + len > fw->len) {
+		ath3k_err("%s: %d bytes at %d is outside the image\n",
+		    __func__,
+		    len,
+		    off);
+		return (0);
+	}
+	if (len > ATH3K_FW_OVERLAY_LEN ||
+	    fw->noverlays >= ATH3K_FW_MAX_OVERLAYS) {
+		ath3k_err("%s: out of overlay space\n", __func__);
+		return (0);
+	}
+
+	o = &fw->overlays[fw->noverlays++];
+	o->off = off;
+	o->len = len;
+	memcpy(o->data, data, len);
+	return (1);
+}
+
+/*
+ * Apply the overlays to buf, which holds the len bytes of the
+ * image starting at off.  Later overlays win.
+ *
+ * Returns the number of overlays that touched buf.
+ */
+int
+ath3k_fw_overlay_apply(const struct ath3k_firmware *fw, int off,
+    unsigned char *buf, int len)
+{
+	const struct ath3k_fw_overlay *o;
+	int i, s, e, n = 0;
+
+	for (i = 0; i < fw->noverlays; i++) {
+		o = &fw->overlays[i];
+		s = (o->off > off) ? o->off : off;
+		e = (o->off + o->len < off + len) ? o->off + o->len : off + len;
+		if (s >= e)
+			continue;
+		memcpy(buf + (s - off), o->data + (s - o->off), e - s);
+		n++;
+	}
+	return (n);
+}
@@ -43,14 +43,42 @@ struct ath3k_version {
 	unsigned char	reserved[0x07];
 };
 
+/*
+ * Small per-device changes (eg the BD_ADDR) are kept as overlays on
+ * top of the shared image rather than by copying it; they're applied
+ * to each chunk as it's sent.
+ */
+#define	ATH3K_FW_MAX_OVERLAYS		16
+#define	ATH3K_FW_OVERLAY_LEN		16
+
+struct ath3k_fw_overlay {
+	int off;
+	int len;
+	unsigned char data[ATH3K_FW_OVERLAY_LEN];
+};
+
+/* The .dfu header in front of the payload */
+#define	FW_HDR_SIZE			20
+
 struct ath3k_firmware {
-	char *fwname;
+	char fwname[FILENAME_MAX];
 	int len;		/* firmware length */
 	int size;		/* buffer size */
 	unsigned char *buf;
+	int noverlays;
+	struct ath3k_fw_overlay overlays[ATH3K_FW_MAX_OVERLAYS];
 };
 
 extern	int ath3k_fw_read(struct ath3k_firmware *fw, const char *fwname);
 extern	void ath3k_fw_free(struct ath3k_firmware *fw);
+extern	int ath3k_fw_alloc(struct ath3k_firmware *fw, int size);
+extern	int ath3k_fw_grow(struct ath3k_firmware *fw, int size);
+extern	void ath3k_fw_prefetch(const char *fwname);
+extern	int ath3k_fw_write(const struct ath3k_firmware *fw,
+	    const char *fwname);
+extern	int ath3k_fw_overlay_add(struct ath3k_firmware *fw, int off,
+	    const unsigned char *data, int len);
+extern	int ath3k_fw_overlay_apply(const struct ath3k_firmware *fw, int off,
+	    unsigned char *buf, int len);
 
 #endif
@@ -0,0 +1,192 @@
+/*-
+ * Copyright (c) 2013 Adrian Chadd <adrian@freebsd.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer,
+ *    without modification.
+ * 2. Redistributions in binary form must reproduce at minimum a disclaimer
+ *    similar to the "NO WARRANTY" disclaimer below ("Disclaimer") and any
+ *    redistribution must be conditioned upon including a substantially
+ *    similar Disclaimer requirement for further binary redistribution.
+ *
+ * NO WARRANTY
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF NONINFRINGEMENT, MERCHANTIBILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGES.
+ *
+ * $FreeBSD$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+
+#include <libusb.h>
+
+#include "ath3k_hci.h"
+#include "ath3k_dbg.h"
+
+/*
+ * Send an HCI command over the control endpoint.
+ */
+static int
+ath3k_hci_cmd(libusb_device_handle *hdl, uint16_t opcode)
+{
+	unsigned char buf[3];
+	int ret;
+
+	buf[0] = opcode & 0xff;
+	buf[1] = (opcode >> 8) & 0xff;
+	buf[2] = 0;		/* no parameters */
+
+	ret = libusb_control_transfer(hdl,
+	    LIBUSB_REQUEST_TYPE_CLASS | LIBUSB_RECIPIENT_INTERFACE,
+	    0,
+	    0,
+	    ATH3K_HCI_IFACE,
+	    buf,
+	    sizeof(buf),
+	    ATH3K_HCI_TIMEOUT);
+	if (ret != sizeof(buf)) {
+		ath3k_err("%s: opcode 0x%04x: libusb_control_transfer() "
+		    "failed: code=%d\n",
+		    __func__,
+		    opcode,
+		    ret);
+		return (-1);
+	}
+
+	return (0);
+}
+
+/*
+ * Wait for the command complete event for the given opcode and
+ * copy out its return parameters.  Other events are skipped.
+ *
+ * Returns the number of parameter bytes, or -1 on error.
+ */
+static int
+ath3k_hci_wait(libusb_device_handle *hdl, uint16_t opcode,
+    unsigned char *params, int len)
+{
+	unsigned char buf[64];
+	int i, ret, r, plen;
+
+	for (i = 0; i < ATH3K_HCI_MAX_EVENTS; i++) {
+		ret = libusb_interrupt_transfer(hdl,
+		    ATH3K_HCI_EVENT_EP,
+		    buf,
+		    sizeof(buf),
+		    &r,
+		    ATH3K_HCI_TIMEOUT);
+		if (ret < 0) {
+			ath3k_err("%s: opcode 0x%04x: no event: %s\n",
+			    __func__,
+			    opcode,
+			    libusb_strerror(ret));
+			return (-1);
+		}
+		if (r < 2 || r < 2 + buf[1])
+			continue;
+
+		ath3k_debug("%s: event 0x%02x, len %d\n",
+		    __func__,
+		    buf[0],
+		    buf[1]);
+
+		if (buf[0] == HCI_EV_CMD_STATUS && buf[1] >= 4 &&
+		    (buf[4] | (buf[5] << 8)) == opcode && buf[2] != 0) {
+			ath3k_err("%s: opcode 0x%04x: status 0x%02x\n",
+			    __func__,
+			    opcode,
+			    buf[2]);
+			return (-1);
+		}
+
+		if (buf[0] != HCI_EV_CMD_COMPLETE || buf[1] < 3 ||
+		    (buf[3] | (buf[4] << 8)) != opcode)
+			continue;
+
+		plen = buf[1] - 3;
+		if (plen > len)
+			plen = len;
+		memcpy(params, buf + 5, plen);
+		return (plen);
+	}
+
+	ath3k_err("%s: opcode 0x%04x: gave up waiting\n", __func__, opcode);
+	return (-1);
+}
+
+/*
+ * Check the device is running a working HCI: reset it and read
+ * back the local version information.
+ *
+ * Returns 1 if it answered, 0 otherwise.
+ */
+int
+ath3k_hci_probe(libusb_device *dev, struct ath3k_hci_version *hv)
+{
+	libusb_device_handle *hdl;
+	unsigned char p[16];
+	int r, ok = 0;
+
+	r = libusb_open(dev, &hdl);
+	if (r != 0) {
+		ath3k_err("%s: libusb_open() failed: code %d\n", __func__, r);
+		return (0);
+	}
+
+	/* Borrow the interface from the kernel driver, if attached */
+	(void) libusb_set_auto_detach_kernel_driver(hdl, 1);
+	r = libusb_claim_interface(hdl, ATH3K_HCI_IFACE);
+	if (r != 0) {
+		ath3k_err("%s: libusb_claim_interface() failed: %s\n",
+		    __func__,
+		    libusb_strerror(r));
+		libusb_close(hdl);
+		return (0);
+	}
+
+	if (ath3k_hci_cmd(hdl, HCI_OP_RESET) != 0)
+		goto done;
+	r = ath3k_hci_wait(hdl, HCI_OP_RESET, p, sizeof(p));
+	if (r < 1 || p[0] != 0) {
+		ath3k_err("%s: HCI_Reset failed\n", __func__);
+		goto done;
+	}
+
+	if (ath3k_hci_cmd(hdl, HCI_OP_READ_LOCAL_VERSION) != 0)
+		goto done;
+	r = ath3k_hci_wait(hdl, HCI_OP_READ_LOCAL_VERSION, p, sizeof(p));
+	if (r < 9 || p[0] != 0) {
+		ath3k_err("%s: HCI_Read_Local_Version failed\n", __func__);
+		goto done;
+	}
+
+	hv->hci_ver = p[1];
+	hv->hci_rev = p[2] | (p[3] << 8);
+	hv->lmp_ver = p[4];
+	hv->manufacturer = p[5] | (p[6] << 8);
+	hv->lmp_subver = p[7] | (p[8] << 8);
+	ok = 1;
+
+done:
+	libusb_release_interface(hdl, ATH3K_HCI_IFACE);
+	libusb_close(hdl);
+	return (ok);
+}
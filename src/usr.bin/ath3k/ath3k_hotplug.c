@@ -0,0 +1,214 @@
+/*-
+ * Copyright (c) 2013 Adrian Chadd <adrian@freebsd.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer,
+ *    without modification.
+ * 2. Redistributions in binary form must reproduce at minimum a disclaimer
+ *    similar to the "NO WARRANTY" disclaimer below ("Disclaimer") and any
+ *    redistribution must be conditioned upon including a substantially
+ *    similar Disclaimer requirement for further binary redistribution.
+ *
+ * NO WARRANTY
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF NONINFRINGEMENT, MERCHANTIBILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGES.
+ *
+ * $FreeBSD$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+
+#include <libusb.h>
+
+#include "ath3k_hotplug.h"
+#include "ath3k_dbg.h"
+#include "ath3k_time.h"
+
+#ifndef	__unused
+#define	__unused	__attribute__((__unused__))
+#endif
+
+/*
+ * Is this device plugged in where ours was?  It comes back with a
+ * new address, but on the same bus and port.
+ */
+static int
+ath3k_hotplug_same_port(struct ath3k_hotplug *hp, libusb_device *dev)
+{
+	uint8_t ports[ATH3K_HOTPLUG_MAX_PORTS];
+	int n;
+
+	if (libusb_get_bus_number(dev) != hp->bus)
+		return (0);
+	if (hp->nports <= 0)
+		return (1);
+	n = libusb_get_port_numbers(dev, ports, sizeof(ports));
+	return (n == hp->nports && memcmp(ports, hp->ports, n) == 0);
+}
+
+static int
+ath3k_hotplug_cb(libusb_context *ctx __unused, libusb_device *dev,
+    libusb_hotplug_event event __unused, void *arg)
+{
+	struct ath3k_hotplug *hp = arg;
+	struct libusb_device_descriptor d;
+
+	/*
+	 * Anything turning up before we've asked the device to switch
+	 * isn't it coming back.
+	 */
+	if (hp->arrived || hp->start == 0)
+		return (0);
+
+	if (! ath3k_hotplug_same_port(hp, dev))
+		return (0);
+
+	if (libusb_get_device_descriptor(dev, &d) != 0)
+		return (0);
+
+	/*
+	 * The loader comes back under the same vendor id, but with
+	 * either a new product id or a bumped bcdDevice.
+	 */
+	if (d.idProduct == hp->product_id && d.bcdDevice == hp->bcd_device)
+		return (0);
+
+	hp->latency = ath3k_time_usec() - hp->start;
+	hp->dev = libusb_ref_device(dev);
+	hp->desc = d;
+	hp->arrived = 1;
+
+	ath3k_debug("%s: %04x:%04x bcdDevice=0x%04x arrived\n",
+	    __func__,
+	    d.idVendor,
+	    d.idProduct,
+	    d.bcdDevice);
+
+	/* We're done; deregister */
+	hp->armed = 0;
+	return (1);
+}
+
+/*
+ * Start watching for the device to re-enumerate.  This has to be
+ * done before the firmware is loaded, or the arrival may be missed;
+ * arrivals only count once ath3k_hotplug_start() has been called.
+ */
+int
+ath3k_hotplug_arm(libusb_context *ctx, struct ath3k_hotplug *hp,
+    libusb_device *dev, const struct libusb_device_descriptor *d)
+{
+	int r;
+
+	bzero(hp, sizeof(*hp));
+
+	if (! libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG)) {
+		ath3k_err("%s: libusb has no hotplug support\n", __func__);
+		return (-1);
+	}
+
+	hp->vendor_id = d->idVendor;
+	hp->product_id = d->idProduct;
+	hp->bcd_device = d->bcdDevice;
+	hp->bus = libusb_get_bus_number(dev);
+	hp->nports = libusb_get_port_numbers(dev, hp->ports,
+	    sizeof(hp->ports));
+	if (hp->nports <= 0)
+		ath3k_debug("%s: no port path; matching on the bus only\n",
+		    __func__);
+
+	r = libusb_hotplug_register_callback(ctx,
+	    LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED,
+	    LIBUSB_HOTPLUG_NO_FLAGS,
+	    d->idVendor,
+	    LIBUSB_HOTPLUG_MATCH_ANY,
+	    LIBUSB_HOTPLUG_MATCH_ANY,
+	    ath3k_hotplug_cb,
+	    hp,
+	    &hp->cb);
+	if (r != LIBUSB_SUCCESS) {
+		ath3k_err("%s: libusb_hotplug_register_callback: %s\n",
+		    __func__,
+		    libusb_strerror(r));
+		return (-1);
+	}
+
+	hp->armed = 1;
+	return (0);
+}
+
+/*
+ * Note that the device is being told to switch to the loaded
+ * firmware; the latency is measured from here.
+ */
+void
+ath3k_hotplug_start(struct ath3k_hotplug *hp)
+{
+
+	hp->start = ath3k_time_usec();
+}
+
+/*
+ * Wait up to timeout_ms for the device to arrive.  The latency is
+ * measured from ath3k_hotplug_start().
+ *
+ * Returns 1 if it arrived, 0 on timeout.
+ */
+int
+ath3k_hotplug_wait(libusb_context *ctx, struct ath3k_hotplug *hp,
+    int timeout_ms)
+{
+	struct timeval tv;
+	uint64_t end, now;
+	int r;
+
+	end = ath3k_time_usec() + (uint64_t) timeout_ms * 1000ULL;
+
+	while (! hp->arrived) {
+		now = ath3k_time_usec();
+		if (now >= end)
+			break;
+		tv.tv_sec = (end - now) / 1000000ULL;
+		tv.tv_usec = (end - now) % 1000000ULL;
+		r = libusb_handle_events_timeout_completed(ctx, &tv,
+		    &hp->arrived);
+		if (r < 0 && r != LIBUSB_ERROR_INTERRUPTED) {
+			ath3k_err("%s: libusb_handle_events: %s\n",
+			    __func__,
+			    libusb_strerror(r));
+			break;
+		}
+	}
+
+	return (hp->arrived);
+}
+
+void
+ath3k_hotplug_disarm(libusb_context *ctx, struct ath3k_hotplug *hp)
+{
+
+	if (hp->armed)
+		libusb_hotplug_deregister_callback(ctx, hp->cb);
+	hp->armed = 0;
+
+	if (hp->dev != NULL)
+		libusb_unref_device(hp->dev);
+	hp->dev = NULL;
+}
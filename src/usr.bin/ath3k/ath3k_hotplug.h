@@ -0,0 +1,64 @@
+/*-
+ * Copyright (c) 2013 Adrian Chadd <adrian@freebsd.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer,
+ *    without modification.
+ * 2. Redistributions in binary form must reproduce at minimum a disclaimer
+ *    similar to the "NO WARRANTY" disclaimer below ("Disclaimer") and any
+ *    redistribution must be conditioned upon including a substantially
+ *    similar Disclaimer requirement for further binary redistribution.
+ *
+ * NO WARRANTY
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF NONINFRINGEMENT, MERCHANTIBILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGES.
+ *
+ * $FreeBSD$
+ */
+#ifndef	__ATH3K_HOTPLUG_H__
+#define	__ATH3K_HOTPLUG_H__
+
+/*
+ * Waiting for the device to come back after the firmware load,
+ * under its new product id / bcdDevice.
+ */
+#define	ATH3K_HOTPLUG_MAX_PORTS		7	/* USB 3.0 allows 7 tiers */
+
+struct ath3k_hotplug {
+	libusb_hotplug_callback_handle cb;
+	int		armed;
+	uint16_t	vendor_id;
+	uint16_t	product_id;
+	uint16_t	bcd_device;
+	uint8_t		bus;
+	int		nports;		/* port path, root first */
+	uint8_t		ports[ATH3K_HOTPLUG_MAX_PORTS];
+	int		arrived;
+	libusb_device	*dev;		/* referenced once arrived */
+	struct libusb_device_descriptor desc;
+	uint64_t	start;		/* usec, at the switch; 0 before */
+	uint64_t	latency;	/* usec */
+};
+
+extern	int ath3k_hotplug_arm(libusb_context *ctx, struct ath3k_hotplug *hp,
+	    libusb_device *dev, const struct libusb_device_descriptor *d);
+extern	void ath3k_hotplug_start(struct ath3k_hotplug *hp);
+extern	int ath3k_hotplug_wait(libusb_context *ctx, struct ath3k_hotplug *hp,
+	    int timeout_ms);
+extern	void ath3k_hotplug_disarm(libusb_context *ctx,
+	    struct ath3k_hotplug *hp);
+
+#endif
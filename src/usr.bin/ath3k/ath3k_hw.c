@@ -44,85 +44,744 @@
 
 #include "ath3k_fw.h"
 #include "ath3k_hw.h"
+#include "ath3k_bw.h"
+#include "ath3k_metrics.h"
+#include "ath3k_rec.h"
+#include "ath3k_trace.h"
+#include "ath3k_usdt.h"
+#include "ath3k_prof.h"
+#include "ath3k_report.h"
+#include "ath3k_status.h"
+#include "ath3k_ps.h"
+#include "ath3k_rampatch.h"
+#include "ath3k_bdaddr.h"
 #include "ath3k_dbg.h"
+#include "ath3k_time.h"
 
 #define	XMIN(x, y)	((x) < (y) ? (x) : (y))
 
+/*
+ * Transfer timeouts.
+ *
+ * Rather than a fixed second per call, derive the timeout from the
+ * measured round-trip time (smoothed mean plus four times the mean
+ * deviation, as TCP does) so a dead device fails quickly.
+ *
+ * Each control request is tracked separately: a GETSTATE takes a
+ * millisecond, but a mode switch can legitimately take far longer,
+ * and mustn't be held to the GETSTATE timeout.  Until a request has
+ * its first sample the initial timeout is used.
+ *
+ * Bulk transfers are pipelined, so their RTT is measured from when
+ * each reaches the head of the queue (ie when the one in front of
+ * it completed) rather than from submission; the timeout given to
+ * a transfer then allows for the ones queued in front of it.
+ */
+struct ath3k_rtt {
+	int		valid;
+	uint64_t	srtt;		/* usec */
+	uint64_t	rttvar;		/* usec */
+};
+
+/*
+ * Build version of the patch we downloaded, if any.
+ */
+unsigned int ath3k_patch_build_version = 0;
+
+/*
+ * If set, a PS_ASIC.pst style file to compile and load instead of
+ * the stock ramps file.
+ */
+const char *ath3k_syscfg_pst = NULL;
+
+/*
+ * Likewise, a RamPatch.txt to decode and load instead of the stock
+ * AthrBT_0x*.dfu patch.
+ */
+const char *ath3k_patch_txt = NULL;
+
+/*
+ * Coex profile; selects a pre-built syscfg variant,
+ * ramps_0x<rom>_<clk>_<profile>.dfu.
+ */
+const char *ath3k_coex_profile = NULL;
+
+/*
+ * BD_ADDR to give the device: either set up front, or allocated
+ * from the state file when the syscfg is actually sent.
+ */
+const char *ath3k_bdaddr_state = NULL;
+uint8_t ath3k_bdaddr[ATH3K_BDADDR_LEN];
+int ath3k_bdaddr_valid = 0;
+
+static struct ath3k_rtt ath3k_ctrl_rtt[256];	/* by bRequest */
+static struct ath3k_rtt ath3k_bulk_rtt;
+
+/*
+ * Deadline for the current phase, absolute usec; 0 means none.
+ * Once it has been overrun it stays flagged so the caller can give
+ * up on the device and have it retried later.
+ */
+static uint64_t ath3k_deadline;
+static int ath3k_deadline_overrun;
+
+void
+ath3k_deadline_set(uint64_t deadline)
+{
+
+	ath3k_deadline = deadline;
+}
+
+int
+ath3k_deadline_missed(void)
+{
+
+	return (ath3k_deadline_overrun);
+}
+
+/*
+ * Return the time left before the deadline in usec, (uint64_t) -1
+ * if there's no deadline, or 0 (and flag it) if it has passed.
+ */
+static uint64_t
+ath3k_deadline_left(void)
+{
+	uint64_t now;
+
+	if (ath3k_deadline == 0)
+		return ((uint64_t) -1);
+
+	now = ath3k_time_usec();
+	if (now >= ath3k_deadline) {
+		ath3k_deadline_overrun = 1;
+		return (0);
+	}
+	return (ath3k_deadline - now);
+}
+
+static void
+ath3k_rtt_update(struct ath3k_rtt *r, uint64_t sample)
+{
+	uint64_t delta;
+
+	if (! r->valid) {
+		r->srtt = sample;
+		r->rttvar = sample / 2;
+		r->valid = 1;
+		return;
+	}
+
+	delta = (sample > r->srtt) ? sample - r->srtt : r->srtt - sample;
+	r->rttvar = (3 * r->rttvar + delta) / 4;
+	r->srtt = (7 * r->srtt + sample) / 8;
+}
+
+/*
+ * Return the timeout in milliseconds.
+ */
+static unsigned int
+ath3k_rtt_timeout(const struct ath3k_rtt *r)
+{
+	uint64_t to;
+
+	if (! r->valid)
+		return (ATH3K_TIMEOUT_INIT);
+
+	to = (r->srtt + 4 * r->rttvar) / 1000;
+	if (to < ATH3K_TIMEOUT_MIN)
+		to = ATH3K_TIMEOUT_MIN;
+	if (to > ATH3K_TIMEOUT_MAX)
+		to = ATH3K_TIMEOUT_MAX;
+	return ((unsigned int) to);
+}
+
+/*
+ * The RTT-derived timeout for a transfer with nqueued others ahead
+ * of it, cut short by the phase deadline.  Returns 0 if the deadline
+ * has already passed.
+ */
+static unsigned int
+ath3k_timeout(const struct ath3k_rtt *r, int nqueued)
+{
+	uint64_t left;
+	unsigned int to;
+
+	to = ath3k_rtt_timeout(r) * (nqueued + 1);
+	left = ath3k_deadline_left();
+	if (left == 0)
+		return (0);
+	if (left / 1000 < to)
+		to = (left / 1000) + 1;
+	return (to);
+}
+
+/*
+ * The control transfer and its setup buffer are allocated once by
+ * ath3k_hw_init(); libusb_control_transfer() would allocate both on
+ * every call.  The largest request is the image header.
+ */
+#define	ATH3K_CTRL_MAX_LEN		64
+
+static struct libusb_transfer *ath3k_ctrl_xfer = NULL;
+static unsigned char ath3k_ctrl_buf[LIBUSB_CONTROL_SETUP_SIZE +
+    ATH3K_CTRL_MAX_LEN];
+
+static void
+ath3k_ctrl_cb(struct libusb_transfer *xfer)
+{
+
+	*(int *) xfer->user_data = 1;
+}
+
+/*
+ * Submit the control transfer and wait for it, as
+ * libusb_control_transfer() does.
+ *
+ * Returns the number of bytes transferred or a LIBUSB_ERROR code.
+ */
+static int
+ath3k_ctrl_submit(struct libusb_device_handle *hdl, uint8_t request_type,
+    uint8_t request, unsigned char *data, uint16_t len, unsigned int to)
+{
+	struct libusb_transfer *xfer = ath3k_ctrl_xfer;
+	int done = 0, ret;
+
+	if (xfer == NULL) {
+		ath3k_err("%s: ath3k_hw_init() not called\n", __func__);
+		return (LIBUSB_ERROR_OTHER);
+	}
+	if (len > ATH3K_CTRL_MAX_LEN)
+		return (LIBUSB_ERROR_INVALID_PARAM);
+
+	libusb_fill_control_setup(ath3k_ctrl_buf, request_type, request,
+	    0, 0, len);
+	if ((request_type & LIBUSB_ENDPOINT_DIR_MASK) == LIBUSB_ENDPOINT_OUT &&
+	    len != 0)
+		memcpy(ath3k_ctrl_buf + LIBUSB_CONTROL_SETUP_SIZE, data, len);
+	libusb_fill_control_transfer(xfer, hdl, ath3k_ctrl_buf,
+	    ath3k_ctrl_cb, &done, to);
+
+	ret = libusb_submit_transfer(xfer);
+	if (ret < 0)
+		return (ret);
+
+	while (! done) {
+		ret = libusb_handle_events_completed(ath3k_ctx, &done);
+		if (ret < 0 && ret != LIBUSB_ERROR_INTERRUPTED) {
+			/* Get it back before the buffer's reused */
+			(void) libusb_cancel_transfer(xfer);
+			while (! done) {
+				if (libusb_handle_events_completed(ath3k_ctx,
+				    &done) < 0)
+					break;
+			}
+			return (ret);
+		}
+	}
+
+	switch (xfer->status) {
+	case LIBUSB_TRANSFER_COMPLETED:
+		if ((request_type & LIBUSB_ENDPOINT_DIR_MASK) ==
+		    LIBUSB_ENDPOINT_IN)
+			memcpy(data, ath3k_ctrl_buf + LIBUSB_CONTROL_SETUP_SIZE,
+			    xfer->actual_length);
+		return (xfer->actual_length);
+	case LIBUSB_TRANSFER_TIMED_OUT:
+		return (LIBUSB_ERROR_TIMEOUT);
+	case LIBUSB_TRANSFER_STALL:
+		return (LIBUSB_ERROR_PIPE);
+	case LIBUSB_TRANSFER_NO_DEVICE:
+		return (LIBUSB_ERROR_NO_DEVICE);
+	case LIBUSB_TRANSFER_OVERFLOW:
+		return (LIBUSB_ERROR_OVERFLOW);
+	default:
+		return (LIBUSB_ERROR_IO);
+	}
+}
+
+/*
+ * A control transfer with an RTT-derived timeout.
+ */
+static int
+ath3k_control_transfer(struct libusb_device_handle *hdl,
+    uint8_t request_type, uint8_t request, unsigned char *data,
+    uint16_t len)
+{
+	uint64_t start;
+	unsigned int to;
+	int ret;
+
+	to = ath3k_timeout(&ath3k_ctrl_rtt[request], 0);
+	if (to == 0) {
+		ath3k_debug("%s: deadline passed; not sending request 0x%02x\n",
+		    __func__,
+		    request);
+		ath3k_counter_add(ATH3K_CTR_TIMEOUTS, 1);
+		return (LIBUSB_ERROR_TIMEOUT);
+	}
+
+	ATH3K_USDT_PROBE(ctrl__start, ath3k_dev_id, request, len);
+	start = ath3k_time_usec();
+	ret = ath3k_ctrl_submit(hdl, request_type, request, data, len, to);
+	start = ath3k_time_usec() - start;
+	ath3k_rec(ATH3K_REC_CTRL, request, len, ret, (int) start);
+	ATH3K_USDT_PROBE(ctrl__done, ath3k_dev_id, request, ret, start);
+	ath3k_counter_add(ATH3K_CTR_CTRL_XFERS, 1);
+	ath3k_hist_add(ATH3K_OP_CTRL, start);
+	if (ret >= 0) {
+		ath3k_rtt_update(&ath3k_ctrl_rtt[request], start);
+	} else {
+		ath3k_counter_add(ATH3K_CTR_CTRL_ERRORS, 1);
+		if (ret == LIBUSB_ERROR_TIMEOUT)
+			ath3k_counter_add(ATH3K_CTR_TIMEOUTS, 1);
+	}
+
+	return (ret);
+}
+
+/*
+ * Bulk download pipelining.
+ *
+ * The right number of in-flight bulk transfers depends upon the
+ * host controller, the hub chain and the dongle itself, so rather
+ * than hard-coding it, adjust it additively up / multiplicatively
+ * down per round of completed chunks.  The window is kept across
+ * ath3k_load_fwfile() calls so later downloads start at the value
+ * the earlier ones settled on.
+ */
+struct ath3k_aimd {
+	int		window;		/* current in-flight limit */
+	int		round_left;	/* chunks left in this round */
+	int		round_bytes;
+	uint64_t	round_start;
+	uint64_t	round_lat;	/* summed chunk latency, usec */
+	int		round_chunks;
+	uint64_t	last_bps;	/* previous round throughput */
+	uint64_t	last_lat;	/* previous round mean latency */
+};
+
+static struct ath3k_aimd ath3k_aimd = { .window = 1 };
+
+struct ath3k_bulk_slot {
+	struct libusb_transfer *xfer;
+	uint64_t	submitted;
+	int		offset;
+	int		busy;
+	int		done;
+	int		*ncomplete;
+	uint64_t	*last_done;	/* when the previous one completed */
+	uint64_t	service;	/* usec at the head of the queue */
+	unsigned char	bounce[BULK_SIZE];	/* for overlaid chunks */
+};
+
+/*
+ * The bulk slots and their transfers are set up once, by
+ * ath3k_hw_init(), and reused for every image.
+ */
+static struct ath3k_bulk_slot ath3k_bulk_slots[ATH3K_MAX_INFLIGHT];
+
+static void
+ath3k_aimd_round_start(struct ath3k_aimd *a, uint64_t now)
+{
+	a->round_left = a->window;
+	a->round_bytes = 0;
+	a->round_lat = 0;
+	a->round_chunks = 0;
+	a->round_start = now;
+}
+
+static void
+ath3k_aimd_backoff(struct ath3k_aimd *a)
+{
+	ath3k_counter_add(ATH3K_CTR_BULK_BACKOFFS, 1);
+	a->window = a->window / 2;
+	if (a->window < 1)
+		a->window = 1;
+	/* Re-learn the baseline at the new window */
+	a->last_bps = 0;
+	a->last_lat = 0;
+}
+
+/*
+ * Account a completed chunk; at the end of each round decide
+ * whether to open up, hold or back off the window.
+ */
+static void
+ath3k_aimd_complete(struct ath3k_aimd *a, int bytes, uint64_t lat,
+    uint64_t now)
+{
+	uint64_t bps, mlat, elapsed;
+
+	a->round_bytes += bytes;
+	a->round_lat += lat;
+	a->round_chunks++;
+
+	if (--a->round_left > 0)
+		return;
+
+	elapsed = now - a->round_start;
+	if (elapsed == 0)
+		elapsed = 1;
+	bps = (uint64_t) a->round_bytes * 1000000ULL / elapsed;
+	mlat = a->round_lat / a->round_chunks;
+
+	if (a->last_lat != 0 && mlat > a->last_lat + a->last_lat / 2) {
+		/* Chunk latency went up sharply; we're queueing */
+		ath3k_aimd_backoff(a);
+	} else if (bps > a->last_bps + a->last_bps / 32) {
+		/* Still getting faster; try one more */
+		if (a->window < ATH3K_MAX_INFLIGHT)
+			a->window++;
+		a->last_bps = bps;
+		a->last_lat = mlat;
+	}
+	/* Otherwise we're at the knee; hold */
+
+	ath3k_rec(ATH3K_REC_BULK_ROUND, (int) bps, (int) mlat, a->window, 0);
+
+	ath3k_aimd_round_start(a, now);
+}
+
+static void
+ath3k_bulk_cb(struct libusb_transfer *xfer)
+{
+	struct ath3k_bulk_slot *s = xfer->user_data;
+	uint64_t now, head;
+
+	/*
+	 * Transfers on the endpoint complete in order, so this one got
+	 * to the head of the queue when it was submitted or when the
+	 * previous one completed, whichever was later.
+	 */
+	now = ath3k_time_usec();
+	head = (*s->last_done > s->submitted) ? *s->last_done : s->submitted;
+	s->service = now - head;
+	*s->last_done = now;
+
+	s->done = 1;
+	(*s->ncomplete)++;
+}
+
+/*
+ * Push the firmware body out the bulk endpoint, keeping up to
+ * ath3k_aimd.window transfers queued.
+ */
+static int
+ath3k_load_bulk(struct libusb_device_handle *hdl,
+    const struct ath3k_firmware *fw, int sent, int count)
+{
+	struct ath3k_bulk_slot *slots = ath3k_bulk_slots;
+	struct libusb_transfer *xfer;
+	struct timeval tv;
+	unsigned char *data;
+	int i, size, ret, ncomplete, inflight = 0, error = 0;
+	unsigned int to;
+	uint64_t now, start, left, throttle, last_done = 0;
+
+	for (i = 0; i < ATH3K_MAX_INFLIGHT; i++) {
+		if (slots[i].xfer == NULL) {
+			ath3k_err("%s: ath3k_hw_init() not called\n",
+			    __func__);
+			return (-1);
+		}
+		slots[i].busy = 0;
+		slots[i].done = 0;
+		slots[i].ncomplete = &ncomplete;
+		slots[i].last_done = &last_done;
+	}
+
+	start = ath3k_time_usec();
+	ath3k_aimd_round_start(&ath3k_aimd, start);
+
+	while (count > 0 || inflight > 0) {
+		/*
+		 * Top up the queue, as far as the bandwidth limit allows;
+		 * if it's out of tokens, wait for them below whilst
+		 * servicing what's already in flight, so completions
+		 * (and the RTT and AIMD samples) aren't held up.
+		 */
+		throttle = 0;
+		for (i = 0; i < ATH3K_MAX_INFLIGHT && error == 0 &&
+		    count > 0 && inflight < ath3k_aimd.window; i++) {
+			if (slots[i].busy)
+				continue;
+			size = XMIN(count, BULK_SIZE);
+			throttle = ath3k_bw_delay(size);
+			if (throttle != 0)
+				break;
+			to = ath3k_timeout(&ath3k_bulk_rtt, inflight);
+			if (to == 0) {
+				ath3k_err("%s: deadline passed at offset %d\n",
+				    __func__,
+				    sent);
+				error = -ETIMEDOUT;
+				break;
+			}
+			ath3k_rec(ATH3K_REC_BULK_SUBMIT, sent, size,
+			    ath3k_aimd.window, 0);
+			data = fw->buf + sent;
+			if (fw->noverlays != 0) {
+				memcpy(slots[i].bounce, data, size);
+				if (ath3k_fw_overlay_apply(fw, sent,
+				    slots[i].bounce, size) != 0)
+					data = slots[i].bounce;
+			}
+			libusb_fill_bulk_transfer(slots[i].xfer, hdl,
+			    0x2,
+			    data,
+			    size,
+			    ath3k_bulk_cb,
+			    &slots[i],
+			    to);
+			ATH3K_USDT_PROBE(bulk__submit, ath3k_dev_id, sent,
+			    size);
+			slots[i].done = 0;
+			slots[i].offset = sent;
+			slots[i].submitted = ath3k_time_usec();
+			ret = libusb_submit_transfer(slots[i].xfer);
+			if (ret < 0) {
+				fprintf(stderr, "Can't load firmware: "
+				    "err=%s, size=%d\n",
+				    libusb_strerror(ret),
+				    size);
+				error = -1;
+				break;
+			}
+			ath3k_bw_take(size);
+			slots[i].busy = 1;
+			inflight++;
+			sent  += size;
+			count -= size;
+		}
+
+		if (inflight == 0) {
+			if (throttle == 0)
+				break;
+			/* Nothing to service; just wait for the tokens */
+			left = ath3k_deadline_left();
+			if (left != 0 && throttle > left)
+				throttle = left;
+			usleep((useconds_t) throttle);
+			continue;
+		}
+
+		/*
+		 * Wait for a completion, but no longer than the deadline.
+		 * On error or once the deadline passes, cancel whatever is
+		 * still queued and just drain the cancellations.
+		 */
+		left = ath3k_deadline_left();
+		if (left == 0) {
+			if (error == 0) {
+				ath3k_err("%s: deadline passed at offset %d; "
+				    "aborting\n",
+				    __func__,
+				    sent);
+				ath3k_rec(ATH3K_REC_DEADLINE, sent, 0, 0, 0);
+			}
+			error = -ETIMEDOUT;
+			left = ATH3K_TIMEOUT_MIN * 1000ULL;
+		}
+		if (error != 0) {
+			for (i = 0; i < ATH3K_MAX_INFLIGHT; i++) {
+				if (slots[i].busy && ! slots[i].done)
+					libusb_cancel_transfer(slots[i].xfer);
+			}
+			count = 0;
+		}
+		if (left > 60 * 1000000ULL)
+			left = 60 * 1000000ULL;
+		if (error == 0 && throttle != 0 && throttle < left)
+			left = throttle;
+		tv.tv_sec = left / 1000000ULL;
+		tv.tv_usec = left % 1000000ULL;
+
+		ncomplete = 0;
+		ret = libusb_handle_events_timeout_completed(ath3k_ctx, &tv,
+		    &ncomplete);
+		if (ret < 0 && ret != LIBUSB_ERROR_INTERRUPTED) {
+			ath3k_err("%s: libusb_handle_events failed: %s\n",
+			    __func__,
+			    libusb_strerror(ret));
+			if (error == 0)
+				error = -1;
+		}
+
+		/* Reap completions */
+		now = ath3k_time_usec();
+		for (i = 0; i < ATH3K_MAX_INFLIGHT; i++) {
+			if (! slots[i].busy || ! slots[i].done)
+				continue;
+			xfer = slots[i].xfer;
+			slots[i].busy = 0;
+			inflight--;
+
+			ath3k_rec(ATH3K_REC_BULK_DONE, slots[i].offset,
+			    xfer->actual_length, (int) xfer->status,
+			    (int) (now - slots[i].submitted));
+			ATH3K_USDT_PROBE(bulk__done, ath3k_dev_id,
+			    slots[i].offset, xfer->actual_length,
+			    (int) xfer->status,
+			    now - slots[i].submitted);
+			if (xfer->status == LIBUSB_TRANSFER_CANCELLED)
+				continue;
+			if (xfer->status != LIBUSB_TRANSFER_COMPLETED ||
+			    xfer->actual_length != xfer->length) {
+				fprintf(stderr, "Can't load firmware: "
+				    "status=%d, size=%d\n",
+				    (int) xfer->status,
+				    xfer->length);
+				ath3k_counter_add(ATH3K_CTR_BULK_ERRORS, 1);
+				if (xfer->status == LIBUSB_TRANSFER_TIMED_OUT) {
+					ath3k_counter_add(ATH3K_CTR_TIMEOUTS,
+					    1);
+					ath3k_aimd_backoff(&ath3k_aimd);
+				}
+				if (error == 0)
+					error = -1;
+				continue;
+			}
+			ath3k_counter_add(ATH3K_CTR_BULK_BYTES, xfer->length);
+			ath3k_status_bytes(xfer->length);
+			ath3k_counter_add(ATH3K_CTR_BULK_CHUNKS, 1);
+			ath3k_hist_add(ATH3K_OP_BULK, now - slots[i].submitted);
+			ath3k_trace_instant("chunk", slots[i].offset,
+			    xfer->length);
+			ath3k_rtt_update(&ath3k_bulk_rtt, slots[i].service);
+			ath3k_aimd_complete(&ath3k_aimd, xfer->length,
+			    now - slots[i].submitted, now);
+		}
+
+		/* Answer any status requests between transfers */
+		ath3k_status_poll();
+	}
+
+	if (error == 0) {
+		now = ath3k_time_usec();
+		ath3k_info("%s: %s: %d bytes in %llu us; "
+		    "settled on %d in-flight transfers\n",
+		    __func__,
+		    fw->fwname,
+		    fw->len,
+		    (unsigned long long) (now - start),
+		    ath3k_aimd.window);
+	}
+
+	return (error);
+}
+
+/*
+ * Allocate the control and bulk transfers up front, so loading an
+ * image doesn't have to.
+ *
+ * Returns 1 on success, 0 on error.
+ */
+int
+ath3k_hw_init(void)
+{
+	int i;
+
+	ath3k_ctrl_xfer = libusb_alloc_transfer(0);
+	if (ath3k_ctrl_xfer == NULL) {
+		ath3k_err("%s: libusb_alloc_transfer failed\n", __func__);
+		return (0);
+	}
+	for (i = 0; i < ATH3K_MAX_INFLIGHT; i++) {
+		ath3k_bulk_slots[i].xfer = libusb_alloc_transfer(0);
+		if (ath3k_bulk_slots[i].xfer == NULL) {
+			ath3k_err("%s: libusb_alloc_transfer failed\n",
+			    __func__);
+			ath3k_hw_fini();
+			return (0);
+		}
+	}
+	return (1);
+}
+
+void
+ath3k_hw_fini(void)
+{
+	int i;
+
+	if (ath3k_ctrl_xfer != NULL)
+		libusb_free_transfer(ath3k_ctrl_xfer);
+	ath3k_ctrl_xfer = NULL;
+	for (i = 0; i < ATH3K_MAX_INFLIGHT; i++) {
+		if (ath3k_bulk_slots[i].xfer != NULL)
+			libusb_free_transfer(ath3k_bulk_slots[i].xfer);
+		ath3k_bulk_slots[i].xfer = NULL;
+	}
+}
+
 int
 ath3k_load_fwfile(struct libusb_device_handle *hdl,
     const struct ath3k_firmware *fw)
 {
+	unsigned char hdr[FW_HDR_SIZE];
 	int size, count, sent = 0;
-	int ret, r;
+	uint64_t start;
+	int ret;
 
+	start = ath3k_time_usec();
 	count = fw->len;
 
 	size = XMIN(count, FW_HDR_SIZE);
 
 	ath3k_debug("%s: file=%s, size=%d\n",
 	    __func__, fw->fwname, count);
+	ath3k_rec(ATH3K_REC_FWFILE, count, 0, 0, 0);
+	ath3k_report_file(fw->fwname, count);
+	ath3k_status_file(fw->fwname, count);
+	ATH3K_USDT_PROBE(fwfile__start, ath3k_dev_id, fw->fwname, count);
+
+	memcpy(hdr, fw->buf, size);
+	ath3k_fw_overlay_apply(fw, 0, hdr, size);
 
 	/*
 	 * Flip the device over to configuration mode.
 	 */
-	ret = libusb_control_transfer(hdl,
+	ret = ath3k_control_transfer(hdl,
 	    LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_ENDPOINT_OUT,
 	    ATH3K_DNLOAD,
-	    0,
-	    0,
-	    fw->buf + sent,
-	    size,
-	    1000);	/* XXX timeout */
+	    hdr,
+	    size);
 
 	if (ret != size) {
 		fprintf(stderr, "Can't switch to config mode; ret=%d\n",
 		    ret);
+		ATH3K_USDT_PROBE(fwfile__done, ath3k_dev_id, fw->fwname, -1);
 		return (-1);
 	}
 
 	sent += size;
 	count -= size;
+	ath3k_status_bytes(size);
 
 	/* Load in the rest of the data */
-	while (count) {
-		size = XMIN(count, BULK_SIZE);
-		ath3k_debug("%s: transferring %d bytes, offset %d\n",
-		    __func__,
-		    sent,
-		    size);
-
-		ret = libusb_bulk_transfer(hdl,
-		    0x2,
-		    fw->buf + sent,
-		    size,
-		    &r,
-		    1000);
-
-		if (ret < 0 || r != size) {
-			fprintf(stderr, "Can't load firmware: err=%s, size=%d\n",
-			    libusb_strerror(ret),
-			    size);
-			return (-1);
-		}
-		sent  += size;
-		count -= size;
-	}
-	return (0);
+	ret = ath3k_load_bulk(hdl, fw, sent, count);
+	ath3k_hist_add(ATH3K_OP_LOAD_FWFILE, ath3k_time_usec() - start);
+	ath3k_trace_span("load_fwfile", start, fw->fwname);
+	ATH3K_USDT_PROBE(fwfile__done, ath3k_dev_id, fw->fwname, ret);
+	return (ret);
 }
 
+/*
+ * Returns 1 on success, 0 on error; likewise ath3k_get_version().
+ */
 int
 ath3k_get_state(struct libusb_device_handle *hdl, unsigned char *state)
 {
+	uint64_t start;
 	int ret;
 
-	ret = libusb_control_transfer(hdl,
+	start = ath3k_time_usec();
+	ret = ath3k_control_transfer(hdl,
 	    LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_ENDPOINT_IN,
 	    ATH3K_GETSTATE,
-	    0,
-	    0,
 	    state,
-	    1,
-	    1000);	/* XXX timeout */
+	    1);
+	ath3k_hist_add(ATH3K_OP_GET_STATE, ath3k_time_usec() - start);
+	ath3k_trace_span("get_state", start, NULL);
 
 	if (ret < 0) {
 		fprintf(stderr,
@@ -139,16 +798,17 @@ int
 ath3k_get_version(struct libusb_device_handle *hdl,
     struct ath3k_version *version)
 {
+	uint64_t start;
 	int ret;
 
-	ret = libusb_control_transfer(hdl,
+	start = ath3k_time_usec();
+	ret = ath3k_control_transfer(hdl,
 	    LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_ENDPOINT_IN,
 	    ATH3K_GETVERSION,
-	    0,
-	    0,
 	    (unsigned char *) version,
-	    sizeof(struct ath3k_version),
-	    1000);	/* XXX timeout */
+	    sizeof(struct ath3k_version));
+	ath3k_hist_add(ATH3K_OP_GET_VERSION, ath3k_time_usec() - start);
+	ath3k_trace_span("get_version", start, NULL);
 
 	if (ret < 0) {
 		fprintf(stderr,
@@ -163,6 +823,51 @@ ath3k_get_version(struct libusb_device_handle *hdl,
 	return (ret == sizeof(struct ath3k_version));
 }
 
+/*
+ * Build the syscfg (ramps) file name for the given ROM version and
+ * reference clock.
+ */
+static void
+ath3k_syscfg_name(char *buf, size_t len, const char *fw_path,
+    const struct ath3k_version *ver)
+{
+	int clk_value;
+
+	if (ath3k_syscfg_pst != NULL) {
+		snprintf(buf, len, "%s", ath3k_syscfg_pst);
+		return;
+	}
+
+	switch (ver->ref_clock) {
+	case ATH3K_XTAL_FREQ_26M:
+		clk_value = 26;
+		break;
+	case ATH3K_XTAL_FREQ_40M:
+		clk_value = 40;
+		break;
+	case ATH3K_XTAL_FREQ_19P2:
+		clk_value = 19;
+		break;
+	default:
+		clk_value = 0;
+		break;
+	}
+
+	if (ath3k_coex_profile != NULL)
+		snprintf(buf, len, "%s/ar3k/ramps_0x%08x_%d_%s%s",
+		    fw_path,
+		    ver->rom_version,
+		    clk_value,
+		    ath3k_coex_profile,
+		    ".dfu");
+	else
+		snprintf(buf, len, "%s/ar3k/ramps_0x%08x_%d%s",
+		    fw_path,
+		    ver->rom_version,
+		    clk_value,
+		    ".dfu");
+}
+
 int
 ath3k_load_patch(libusb_device_handle *hdl, const char *fw_path)
 {
@@ -170,36 +875,58 @@ ath3k_load_patch(libusb_device_handle *hdl, const char *fw_path)
 	unsigned char fw_state;
 	struct ath3k_version fw_ver, pt_ver;
 	char fwname[FILENAME_MAX];
+	char syscfg[FILENAME_MAX];
 	struct ath3k_firmware fw;
 	uint32_t tmp;
+	uint64_t t;
 
 	ret = ath3k_get_state(hdl, &fw_state);
-	if (ret < 0) {
+	if (ret == 0) {
 		ath3k_err("%s: Can't get state\n", __func__);
-		return (ret);
+		return (-1);
 	}
 
 	if (fw_state & ATH3K_PATCH_UPDATE) {
 		ath3k_info("%s: Patch already downloaded\n",
 		    __func__);
+		ath3k_counter_add(ATH3K_CTR_SKIPPED, 1);
 		return (0);
 	}
 
 	ret = ath3k_get_version(hdl, &fw_ver);
-	if (ret < 0) {
-		ath3k_debug("%s: Can't get version\n", __func__);
-		return (ret);
+	if (ret == 0) {
+		ath3k_err("%s: Can't get version\n", __func__);
+		return (-1);
 	}
 
+	/*
+	 * We now know which syscfg file follows the patch; start
+	 * pulling it in whilst the patch goes out over the bus.
+	 */
+	ath3k_syscfg_name(syscfg, sizeof(syscfg), fw_path, &fw_ver);
+	ath3k_fw_prefetch(syscfg);
+
 	/* XXX path info? */
-	snprintf(fwname, FILENAME_MAX, "%s/ar3k/AthrBT_0x%08x.dfu",
-	    fw_path,
-	    fw_ver.rom_version);
+	if (ath3k_patch_txt != NULL)
+		snprintf(fwname, FILENAME_MAX, "%s", ath3k_patch_txt);
+	else
+		snprintf(fwname, FILENAME_MAX, "%s/ar3k/AthrBT_0x%08x.dfu",
+		    fw_path,
+		    fw_ver.rom_version);
 
-	/* Read in the firmware */
-	if (ath3k_fw_read(&fw, fwname) <= 0) {
-		ath3k_debug("%s: ath3k_fw_read() failed\n",
-		    __func__);
+	/* Read in the firmware, or decode it from the hex source */
+	ath3k_prof_begin("patch read");
+	t = ath3k_trace_start();
+	if (ath3k_patch_txt != NULL)
+		ret = ath3k_rampatch_read(&fw, fwname);
+	else
+		ret = ath3k_fw_read(&fw, fwname);
+	ath3k_trace_span("fw_read", t, fwname);
+	ath3k_prof_begin("patch usb");
+	if (ret <= 0) {
+		ath3k_debug("%s: reading %s failed\n",
+		    __func__,
+		    fwname);
 		return (-1);
 	}
 
@@ -227,6 +954,8 @@ ath3k_load_patch(libusb_device_handle *hdl, const char *fw_path)
 
 	/* Load in the firmware */
 	ret = ath3k_load_fwfile(hdl, &fw);
+	if (ret == 0)
+		ath3k_patch_build_version = pt_ver.build_version;
 
 	/* free it */
 	ath3k_fw_free(&fw);
@@ -241,58 +970,82 @@ ath3k_load_syscfg(libusb_device_handle *hdl, const char *fw_path)
 	char filename[FILENAME_MAX];
 	struct ath3k_firmware fw;
 	struct ath3k_version fw_ver;
-	int clk_value, ret;
+	uint64_t t;
+	int ret;
 
 	ret = ath3k_get_state(hdl, &fw_state);
-	if (ret < 0) {
+	if (ret == 0) {
 		ath3k_err("Can't get state to change to load configuration err");
 		return (-EBUSY);
 	}
 
 	ret = ath3k_get_version(hdl, &fw_ver);
-	if (ret < 0) {
+	if (ret == 0) {
 		ath3k_err("Can't get version to change to load ram patch err");
-		return (ret);
+		return (-1);
 	}
 
-	switch (fw_ver.ref_clock) {
-	case ATH3K_XTAL_FREQ_26M:
-		clk_value = 26;
-		break;
-	case ATH3K_XTAL_FREQ_40M:
-		clk_value = 40;
-		break;
-	case ATH3K_XTAL_FREQ_19P2:
-		clk_value = 19;
-		break;
-	default:
-		clk_value = 0;
-		break;
-}
-
-	snprintf(filename, FILENAME_MAX, "%s/ar3k/ramps_0x%08x_%d%s",
-	    fw_path,
-	    fw_ver.rom_version,
-	    clk_value,
-	    ".dfu");
+	ath3k_syscfg_name(filename, sizeof(filename), fw_path, &fw_ver);
 
 	ath3k_info("%s: syscfg file = %s\n",
 	    __func__,
 	    filename);
 
-	/* Read in the firmware */
-	if (ath3k_fw_read(&fw, filename) <= 0) {
-		ath3k_err("%s: ath3k_fw_read() failed\n",
-		    __func__);
+	/* Read in the firmware, or compile it from the .pst source */
+	ath3k_prof_begin("syscfg read");
+	t = ath3k_trace_start();
+	if (ath3k_syscfg_pst != NULL)
+		ret = ath3k_ps_load(&fw, filename, fw_ver.rom_version);
+	else
+		ret = ath3k_fw_read(&fw, filename);
+	ath3k_trace_span("fw_read", t, filename);
+	ath3k_prof_begin("syscfg usb");
+	if (ret <= 0) {
+		ath3k_err("%s: reading %s failed\n",
+		    __func__,
+		    filename);
+		if (ath3k_coex_profile != NULL)
+			ath3k_err("%s: no %s syscfg is installed for ROM "
+			    "0x%08x\n",
+			    __func__,
+			    ath3k_coex_profile,
+			    fw_ver.rom_version);
 		return (-1);
 	}
 
+	if (ath3k_ps_override_apply(&fw) == 0) {
+		ath3k_fw_free(&fw);
+		return (-1);
+	}
+
+	if (ath3k_bdaddr_state != NULL && ! ath3k_bdaddr_valid) {
+		if (ath3k_bdaddr_alloc(ath3k_bdaddr_state, ath3k_bdaddr) == 0) {
+			ath3k_fw_free(&fw);
+			return (-1);
+		}
+		ath3k_bdaddr_valid = 1;
+	}
+	if (ath3k_bdaddr_valid) {
+		ath3k_info("%s: BD_ADDR %02x:%02x:%02x:%02x:%02x:%02x\n",
+		    __func__,
+		    ath3k_bdaddr[0], ath3k_bdaddr[1], ath3k_bdaddr[2],
+		    ath3k_bdaddr[3], ath3k_bdaddr[4], ath3k_bdaddr[5]);
+		if (ath3k_ps_set_bdaddr(&fw, ath3k_bdaddr) == 0) {
+			ath3k_fw_free(&fw);
+			return (-1);
+		}
+	}
+
 	ret = ath3k_load_fwfile(hdl, &fw);
 
 	ath3k_fw_free(&fw);
 	return (ret);
 }
 
+/*
+ * Returns 0 on success (including if it's already in normal mode),
+ * -1 on error.
+ */
 int
 ath3k_set_normal_mode(libusb_device_handle *hdl)
 {
@@ -300,9 +1053,9 @@ ath3k_set_normal_mode(libusb_device_handle *hdl)
 	unsigned char fw_state;
 
 	ret = ath3k_get_state(hdl, &fw_state);
-	if (ret < 0) {
+	if (ret == 0) {
 		ath3k_err("%s: can't get state\n", __func__);
-		return (ret);
+		return (-1);
 	}
 
 	/*
@@ -312,40 +1065,35 @@ ath3k_set_normal_mode(libusb_device_handle *hdl)
 	if ((fw_state & ATH3K_MODE_MASK) == ATH3K_NORMAL_MODE) {
 		ath3k_debug("%s: firmware is already in normal mode\n",
 		    __func__);
+		ath3k_counter_add(ATH3K_CTR_SKIPPED, 1);
 		return (0);
 	}
 
-	ret = libusb_control_transfer(hdl,
+	ret = ath3k_control_transfer(hdl,
 	    LIBUSB_REQUEST_TYPE_VENDOR,		/* XXX out direction? */
 	    ATH3K_SET_NORMAL_MODE,
-	    0,
-	    0,
 	    NULL,
-	    0,
-	    1000);	/* XXX timeout */
+	    0);
 
 	if (ret < 0) {
 		ath3k_err("%s: libusb_control_transfer() failed: code=%d\n",
 		    __func__,
 		    ret);
-		return (0);
+		return (-1);
 	}
 
-	return (ret == 0);
+	return (0);
 }
 
 int
 ath3k_switch_pid(libusb_device_handle *hdl)
 {
 	int ret;
-	ret = libusb_control_transfer(hdl,
+	ret = ath3k_control_transfer(hdl,
 	    LIBUSB_REQUEST_TYPE_VENDOR,		/* XXX set an out flag? */
 	    USB_REG_SWITCH_VID_PID,
-	    0,
-	    0,
 	    NULL,
-	    0,
-	    1000);	/* XXX timeout */
+	    0);
 
 	if (ret < 0) {
 		ath3k_debug("%s: libusb_control_transfer() failed: code=%d\n",
@@ -50,8 +50,27 @@
 
 #define	USB_REQ_DFU_DNLOAD		1
 #define	BULK_SIZE			4096
-#define	FW_HDR_SIZE			20
+#define	ATH3K_MAX_INFLIGHT		8
 
+/* Transfer timeout bounds, milliseconds */
+#define	ATH3K_TIMEOUT_INIT		1000
+#define	ATH3K_TIMEOUT_MIN		50
+#define	ATH3K_TIMEOUT_MAX		1000
+
+extern	libusb_context *ath3k_ctx;
+extern	int ath3k_dev_id;
+extern	unsigned int ath3k_patch_build_version;
+extern	const char *ath3k_syscfg_pst;
+extern	const char *ath3k_patch_txt;
+extern	const char *ath3k_coex_profile;
+extern	const char *ath3k_bdaddr_state;
+extern	uint8_t ath3k_bdaddr[];
+extern	int ath3k_bdaddr_valid;
+
+extern	int ath3k_hw_init(void);
+extern	void ath3k_hw_fini(void);
+extern	void ath3k_deadline_set(uint64_t deadline);
+extern	int ath3k_deadline_missed(void);
 extern	int ath3k_load_fwfile(struct libusb_device_handle *hdl,
 	    const struct ath3k_firmware *fw);
 extern	int ath3k_get_state(struct libusb_device_handle *hdl,
@@ -0,0 +1,307 @@
+/*-
+ * Copyright (c) 2013 Adrian Chadd <adrian@freebsd.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer,
+ *    without modification.
+ * 2. Redistributions in binary form must reproduce at minimum a disclaimer
+ *    similar to the "NO WARRANTY" disclaimer below ("Disclaimer") and any
+ *    redistribution must be conditioned upon including a substantially
+ *    similar Disclaimer requirement for further binary redistribution.
+ *
+ * NO WARRANTY
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF NONINFRINGEMENT, MERCHANTIBILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGES.
+ *
+ * $FreeBSD$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <err.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include "ath3k_metrics.h"
+#include "ath3k_dbg.h"
+
+uint64_t ath3k_counters[ATH3K_CTR_MAX];
+
+static struct ath3k_hist ath3k_hists[ATH3K_OP_MAX];
+
+static const struct {
+	const char *name;
+	const char *help;
+} ath3k_counter_info[ATH3K_CTR_MAX] = {
+	[ATH3K_CTR_BULK_BYTES] =
+	    { "ath3k_bulk_bytes_total", "Firmware bytes sent" },
+	[ATH3K_CTR_BULK_CHUNKS] =
+	    { "ath3k_bulk_chunks_total", "Bulk transfers completed" },
+	[ATH3K_CTR_BULK_ERRORS] =
+	    { "ath3k_bulk_errors_total", "Bulk transfers failed" },
+	[ATH3K_CTR_BULK_BACKOFFS] =
+	    { "ath3k_bulk_backoffs_total", "In-flight window backoffs" },
+	[ATH3K_CTR_CTRL_XFERS] =
+	    { "ath3k_ctrl_transfers_total", "Control transfers sent" },
+	[ATH3K_CTR_CTRL_ERRORS] =
+	    { "ath3k_ctrl_errors_total", "Control transfers failed" },
+	[ATH3K_CTR_TIMEOUTS] =
+	    { "ath3k_timeouts_total", "Transfers timed out" },
+	[ATH3K_CTR_SKIPPED] =
+	    { "ath3k_skipped_stages_total", "Stages skipped as already done" },
+	[ATH3K_CTR_HEAP_ALLOCS] =
+	    { "ath3k_heap_allocs_total", "Image buffers taken from the heap" },
+};
+
+static const char *ath3k_op_names[ATH3K_OP_MAX] = {
+	[ATH3K_OP_CTRL] = "ctrl_transfer",
+	[ATH3K_OP_BULK] = "bulk_chunk",
+	[ATH3K_OP_GET_STATE] = "get_state",
+	[ATH3K_OP_GET_VERSION] = "get_version",
+	[ATH3K_OP_LOAD_FWFILE] = "load_fwfile",
+	[ATH3K_OP_LOAD_PATCH] = "load_patch",
+	[ATH3K_OP_LOAD_SYSCFG] = "load_syscfg",
+	[ATH3K_OP_SET_NORMAL_MODE] = "set_normal_mode",
+	[ATH3K_OP_SWITCH_PID] = "switch_pid",
+};
+
+/*
+ * Histogram bucket upper bounds, usec; the last bucket is +Inf.
+ */
+static const uint64_t ath3k_hist_bounds[ATH3K_HIST_NBUCKETS - 1] = {
+	100, 250, 500,
+	1000, 2500, 5000,
+	10000, 25000, 50000,
+	100000, 250000, 500000,
+	1000000, 2500000, 5000000,
+};
+
+void
+ath3k_hist_add(int op, uint64_t usec)
+{
+	struct ath3k_hist *h = &ath3k_hists[op];
+	int i;
+
+	for (i = 0; i < ATH3K_HIST_NBUCKETS - 1; i++) {
+		if (usec <= ath3k_hist_bounds[i])
+			break;
+	}
+	h->bucket[i]++;
+	h->sum += usec;
+	h->count++;
+}
+
+static int
+ath3k_metrics_op(const char *name)
+{
+	int i;
+
+	for (i = 0; i < ATH3K_OP_MAX; i++) {
+		if (strcmp(name, ath3k_op_names[i]) == 0)
+			return (i);
+	}
+	return (-1);
+}
+
+static int
+ath3k_metrics_le(const char *le)
+{
+	char buf[32];
+	int i;
+
+	if (strcmp(le, "+Inf") == 0)
+		return (ATH3K_HIST_NBUCKETS - 1);
+	for (i = 0; i < ATH3K_HIST_NBUCKETS - 1; i++) {
+		snprintf(buf, sizeof(buf), "%g",
+		    (double) ath3k_hist_bounds[i] / 1000000.0);
+		if (strcmp(le, buf) == 0)
+			return (i);
+	}
+	return (-1);
+}
+
+/*
+ * Add in what earlier runs left in file, so the counters and
+ * histograms keep counting up across runs as Prometheus expects of
+ * them, rather than starting again from each run's own values.
+ * Lines that don't parse are dropped.
+ */
+static void
+ath3k_metrics_merge(const char *file)
+{
+	uint64_t cum[ATH3K_OP_MAX][ATH3K_HIST_NBUCKETS], prev;
+	char line[256], name[160], val[32], op[32], le[32];
+	FILE *fp;
+	int i, j;
+
+	fp = fopen(file, "r");
+	if (fp == NULL) {
+		if (errno != ENOENT)
+			warn("%s: %s", __func__, file);
+		return;
+	}
+
+	memset(cum, 0, sizeof(cum));
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (line[0] == '#' ||
+		    sscanf(line, "%159s %31s", name, val) != 2)
+			continue;
+
+		for (i = 0; i < ATH3K_CTR_MAX; i++) {
+			if (strcmp(name, ath3k_counter_info[i].name) == 0)
+				ath3k_counters[i] += strtoull(val, NULL, 10);
+		}
+
+		if (sscanf(name, "ath3k_op_duration_seconds_bucket"
+		    "{op=\"%31[^\"]\",le=\"%31[^\"]\"}", op, le) == 2) {
+			i = ath3k_metrics_op(op);
+			j = ath3k_metrics_le(le);
+			if (i >= 0 && j >= 0)
+				cum[i][j] = strtoull(val, NULL, 10);
+		} else if (sscanf(name, "ath3k_op_duration_seconds_sum"
+		    "{op=\"%31[^\"]\"}", op) == 1) {
+			i = ath3k_metrics_op(op);
+			if (i >= 0)
+				ath3k_hists[i].sum +=
+				    strtod(val, NULL) * 1000000.0 + 0.5;
+		} else if (sscanf(name, "ath3k_op_duration_seconds_count"
+		    "{op=\"%31[^\"]\"}", op) == 1) {
+			i = ath3k_metrics_op(op);
+			if (i >= 0)
+				ath3k_hists[i].count +=
+				    strtoull(val, NULL, 10);
+		}
+	}
+	fclose(fp);
+
+	/* The buckets are written cumulative; ours aren't */
+	for (i = 0; i < ATH3K_OP_MAX; i++) {
+		prev = 0;
+		for (j = 0; j < ATH3K_HIST_NBUCKETS; j++) {
+			if (cum[i][j] < prev)
+				continue;
+			ath3k_hists[i].bucket[j] += cum[i][j] - prev;
+			prev = cum[i][j];
+		}
+	}
+}
+
+/*
+ * Write everything out to file, via a temporary file so a scraper
+ * never sees a partial one.  The temporary file is made with
+ * mkstemp() next to file, so the rename stays on one filesystem and
+ * concurrent runs don't trample each other's.  The totals from the
+ * file already there are added in first; file.lock keeps two runs
+ * from both reading the same old totals.
+ *
+ * Returns 1 if OK, 0 on error.
+ */
+int
+ath3k_metrics_write(const char *file)
+{
+	char tmpname[FILENAME_MAX], lockname[FILENAME_MAX];
+	const struct ath3k_hist *h;
+	uint64_t cum;
+	FILE *fp;
+	int fd, lockfd, i, j, r, ret = 0;
+
+	if (snprintf(tmpname, sizeof(tmpname), "%s.XXXXXX", file) >=
+	    (int) sizeof(tmpname) ||
+	    snprintf(lockname, sizeof(lockname), "%s.lock", file) >=
+	    (int) sizeof(lockname)) {
+		ath3k_err("%s: %s: path too long\n", __func__, file);
+		return (0);
+	}
+
+	/* Without the lock a concurrent run's counts may be lost */
+	lockfd = open(lockname, O_RDWR | O_CREAT, 0644);
+	if (lockfd < 0 || flock(lockfd, LOCK_EX) != 0)
+		warn("%s: lock: %s", __func__, lockname);
+	ath3k_metrics_merge(file);
+
+	fd = mkstemp(tmpname);
+	if (fd < 0) {
+		warn("%s: mkstemp: %s", __func__, tmpname);
+		goto done;
+	}
+	/* mkstemp() makes it 0600; scrapers needn't run as us */
+	if (fchmod(fd, 0644) != 0 || (fp = fdopen(fd, "w")) == NULL) {
+		warn("%s: %s", __func__, tmpname);
+		close(fd);
+		unlink(tmpname);
+		goto done;
+	}
+
+	for (i = 0; i < ATH3K_CTR_MAX; i++) {
+		fprintf(fp, "# HELP %s %s\n",
+		    ath3k_counter_info[i].name,
+		    ath3k_counter_info[i].help);
+		fprintf(fp, "# TYPE %s counter\n", ath3k_counter_info[i].name);
+		fprintf(fp, "%s %llu\n",
+		    ath3k_counter_info[i].name,
+		    (unsigned long long) ath3k_counters[i]);
+	}
+
+	fprintf(fp, "# HELP ath3k_op_duration_seconds "
+	    "Time taken by each device operation\n");
+	fprintf(fp, "# TYPE ath3k_op_duration_seconds histogram\n");
+	for (i = 0; i < ATH3K_OP_MAX; i++) {
+		h = &ath3k_hists[i];
+		cum = 0;
+		for (j = 0; j < ATH3K_HIST_NBUCKETS - 1; j++) {
+			cum += h->bucket[j];
+			fprintf(fp, "ath3k_op_duration_seconds_bucket"
+			    "{op=\"%s\",le=\"%g\"} %llu\n",
+			    ath3k_op_names[i],
+			    (double) ath3k_hist_bounds[j] / 1000000.0,
+			    (unsigned long long) cum);
+		}
+		cum += h->bucket[j];
+		fprintf(fp, "ath3k_op_duration_seconds_bucket"
+		    "{op=\"%s\",le=\"+Inf\"} %llu\n",
+		    ath3k_op_names[i],
+		    (unsigned long long) cum);
+		fprintf(fp, "ath3k_op_duration_seconds_sum{op=\"%s\"} %.6f\n",
+		    ath3k_op_names[i],
+		    (double) h->sum / 1000000.0);
+		fprintf(fp, "ath3k_op_duration_seconds_count{op=\"%s\"} %llu\n",
+		    ath3k_op_names[i],
+		    (unsigned long long) h->count);
+	}
+
+	r = ferror(fp);
+	if (fclose(fp) != 0 || r != 0) {
+		warn("%s: write: %s", __func__, tmpname);
+		unlink(tmpname);
+		goto done;
+	}
+	if (rename(tmpname, file) != 0) {
+		warn("%s: rename: %s", __func__, file);
+		unlink(tmpname);
+		goto done;
+	}
+	ret = 1;
+
+done:
+	if (lockfd >= 0)
+		close(lockfd);
+	return (ret);
+}
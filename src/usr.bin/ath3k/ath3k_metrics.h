@@ -0,0 +1,89 @@
+/*-
+ * Copyright (c) 2013 Adrian Chadd <adrian@freebsd.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer,
+ *    without modification.
+ * 2. Redistributions in binary form must reproduce at minimum a disclaimer
+ *    similar to the "NO WARRANTY" disclaimer below ("Disclaimer") and any
+ *    redistribution must be conditioned upon including a substantially
+ *    similar Disclaimer requirement for further binary redistribution.
+ *
+ * NO WARRANTY
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF NONINFRINGEMENT, MERCHANTIBILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGES.
+ *
+ * $FreeBSD$
+ */
+#ifndef	__ATH3K_METRICS_H__
+#define	__ATH3K_METRICS_H__
+
+/*
+ * Counters and latency histograms for the firmware load, written out
+ * in the Prometheus text format for node_exporter's textfile
+ * collector to pick up.
+ *
+ * Everything, including the libusb completion callbacks, runs on the
+ * one thread, so updates are plain (unlocked) increments.
+ */
+
+enum {
+	ATH3K_CTR_BULK_BYTES = 0,	/* firmware bytes sent */
+	ATH3K_CTR_BULK_CHUNKS,		/* bulk transfers completed */
+	ATH3K_CTR_BULK_ERRORS,		/* bulk transfers failed */
+	ATH3K_CTR_BULK_BACKOFFS,	/* in-flight window halved */
+	ATH3K_CTR_CTRL_XFERS,		/* control transfers sent */
+	ATH3K_CTR_CTRL_ERRORS,		/* control transfers failed */
+	ATH3K_CTR_TIMEOUTS,		/* transfers that timed out */
+	ATH3K_CTR_SKIPPED,		/* stages skipped, already done */
+	ATH3K_CTR_HEAP_ALLOCS,		/* image buffers not from the arena */
+	ATH3K_CTR_MAX
+};
+
+enum {
+	ATH3K_OP_CTRL = 0,		/* each control transfer */
+	ATH3K_OP_BULK,			/* each bulk chunk */
+	ATH3K_OP_GET_STATE,
+	ATH3K_OP_GET_VERSION,
+	ATH3K_OP_LOAD_FWFILE,
+	ATH3K_OP_LOAD_PATCH,
+	ATH3K_OP_LOAD_SYSCFG,
+	ATH3K_OP_SET_NORMAL_MODE,
+	ATH3K_OP_SWITCH_PID,
+	ATH3K_OP_MAX
+};
+
+#define	ATH3K_HIST_NBUCKETS		16
+
+struct ath3k_hist {
+	uint64_t	bucket[ATH3K_HIST_NBUCKETS];	/* not cumulative */
+	uint64_t	sum;				/* usec */
+	uint64_t	count;
+};
+
+extern	uint64_t ath3k_counters[ATH3K_CTR_MAX];
+
+static inline void
+ath3k_counter_add(int ctr, uint64_t val)
+{
+
+	ath3k_counters[ctr] += val;
+}
+
+extern	void ath3k_hist_add(int op, uint64_t usec);
+extern	int ath3k_metrics_write(const char *file);
+
+#endif
@@ -0,0 +1,425 @@
+/*-
+ * Copyright (c) 2013 Adrian Chadd <adrian@freebsd.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer,
+ *    without modification.
+ * 2. Redistributions in binary form must reproduce at minimum a disclaimer
+ *    similar to the "NO WARRANTY" disclaimer below ("Disclaimer") and any
+ *    redistribution must be conditioned upon including a substantially
+ *    similar Disclaimer requirement for further binary redistribution.
+ *
+ * NO WARRANTY
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF NONINFRINGEMENT, MERCHANTIBILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGES.
+ *
+ * $FreeBSD$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "ath3k_pin.h"
+#include "ath3k_dbg.h"
+
+#ifndef	__unused
+#define	__unused	__attribute__((__unused__))
+#endif
+
+struct ath3k_pin_file {
+	char		name[FILENAME_MAX];
+	dev_t		dev;
+	ino_t		ino;
+	off_t		size;
+	time_t		mtime;
+	time_t		atime;		/* last used */
+	void		*map;		/* non-NULL while pinned */
+	size_t		maplen;
+	int		seen;
+	int		want;		/* fits under the cap */
+	int		warned;		/* pin failure already reported */
+};
+
+static struct ath3k_pin_file ath3k_pin_files[ATH3K_PIN_MAX_FILES];
+static int ath3k_pin_nfiles = 0;
+static size_t ath3k_pin_pagesize;
+static volatile sig_atomic_t ath3k_pin_hup = 0;
+
+/*
+ * Mark an image as just used.  Only bother once the recorded atime
+ * is stale, so a busy run of hotplugs doesn't keep dirtying the
+ * inode.
+ */
+void
+ath3k_pin_touch(int fd, const struct stat *sb)
+{
+	struct timespec ts[2];
+
+	if (sb->st_atime + ATH3K_PIN_STAMP_SEC > time(NULL))
+		return;
+
+	ts[0].tv_sec = 0;
+	ts[0].tv_nsec = UTIME_NOW;
+	ts[1].tv_sec = 0;
+	ts[1].tv_nsec = UTIME_OMIT;
+	(void) futimens(fd, ts);
+}
+
+static void
+ath3k_pin_unpin(struct ath3k_pin_file *f)
+{
+
+	if (f->map == NULL)
+		return;
+	(void) munlock(f->map, f->maplen);
+	(void) munmap(f->map, f->maplen);
+	f->map = NULL;
+	f->maplen = 0;
+	ath3k_debug("%s: %s\n", __func__, f->name);
+}
+
+/*
+ * Report a failure to pin a file.  It's retried on every rescan, so
+ * only the first failure for a given file is a warning; the rest
+ * go to the debug output until the file changes.
+ */
+static void
+ath3k_pin_fail(struct ath3k_pin_file *f, const char *what)
+{
+
+	if (f->warned) {
+		ath3k_debug("%s: %s: %s: %s\n",
+		    __func__,
+		    what,
+		    f->name,
+		    strerror(errno));
+		return;
+	}
+	warn("pin: %s: %s", what, f->name);
+	f->warned = 1;
+}
+
+static int
+ath3k_pin_pin(struct ath3k_pin_file *f)
+{
+	void *p;
+	int fd;
+
+	fd = open(f->name, O_RDONLY);
+	if (fd < 0) {
+		ath3k_pin_fail(f, "open");
+		return (0);
+	}
+	p = mmap(NULL, f->size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		ath3k_pin_fail(f, "mmap");
+		return (0);
+	}
+	if (mlock(p, f->size) != 0) {
+		ath3k_pin_fail(f, "mlock");
+		(void) munmap(p, f->size);
+		return (0);
+	}
+	f->warned = 0;
+	f->map = p;
+	f->maplen = f->size;
+	ath3k_debug("%s: %s: %lld bytes\n",
+	    __func__,
+	    f->name,
+	    (long long) f->size);
+	return (1);
+}
+
+/*
+ * The images themselves, and the PS_ASIC.pst / RamPatch.txt sources
+ * that -s and -r compile at load time.
+ */
+static int
+ath3k_pin_is_image(const char *name)
+{
+	size_t len = strlen(name);
+
+	return ((len > 4 && strcmp(name + len - 4, ".dfu") == 0) ||
+	    (len > 3 && strcmp(name + len - 3, ".fw") == 0) ||
+	    (len > 4 && strcmp(name + len - 4, ".pst") == 0) ||
+	    strcmp(name, "RamPatch.txt") == 0);
+}
+
+static struct ath3k_pin_file *
+ath3k_pin_lookup(const char *name)
+{
+	int i;
+
+	for (i = 0; i < ath3k_pin_nfiles; i++) {
+		if (strcmp(ath3k_pin_files[i].name, name) == 0)
+			return (&ath3k_pin_files[i]);
+	}
+	return (NULL);
+}
+
+/*
+ * Pick up the images in one directory, noting any that have been
+ * replaced since they were pinned.
+ */
+static void
+ath3k_pin_scan_dir(const char *dir)
+{
+	struct ath3k_pin_file *f;
+	struct dirent *de;
+	struct stat sb;
+	char name[FILENAME_MAX];
+	DIR *d;
+
+	d = opendir(dir);
+	if (d == NULL) {
+		ath3k_debug("%s: opendir: %s: %s\n",
+		    __func__,
+		    dir,
+		    strerror(errno));
+		return;
+	}
+
+	while ((de = readdir(d)) != NULL) {
+		if (! ath3k_pin_is_image(de->d_name))
+			continue;
+		snprintf(name, sizeof(name), "%s/%s", dir, de->d_name);
+		if (stat(name, &sb) != 0 || ! S_ISREG(sb.st_mode) ||
+		    sb.st_size == 0)
+			continue;
+
+		f = ath3k_pin_lookup(name);
+		if (f == NULL) {
+			if (ath3k_pin_nfiles >= ATH3K_PIN_MAX_FILES) {
+				ath3k_debug("%s: %s: too many images\n",
+				    __func__,
+				    name);
+				continue;
+			}
+			f = &ath3k_pin_files[ath3k_pin_nfiles++];
+			bzero(f, sizeof(*f));
+			snprintf(f->name, sizeof(f->name), "%s", name);
+		} else if (f->dev != sb.st_dev || f->ino != sb.st_ino ||
+		    f->size != sb.st_size || f->mtime != sb.st_mtime) {
+			/* Replaced; the old mapping is of the old file */
+			ath3k_pin_unpin(f);
+			f->warned = 0;
+		}
+		f->dev = sb.st_dev;
+		f->ino = sb.st_ino;
+		f->size = sb.st_size;
+		f->mtime = sb.st_mtime;
+		f->atime = sb.st_atime;
+		f->seen = 1;
+	}
+	closedir(d);
+}
+
+/*
+ * Scan the per ROM source directories (ar3k/<rom>/) under dir.
+ */
+static void
+ath3k_pin_scan_subdirs(const char *dir)
+{
+	struct dirent *de;
+	struct stat sb;
+	char name[FILENAME_MAX];
+	DIR *d;
+
+	d = opendir(dir);
+	if (d == NULL)
+		return;
+
+	while ((de = readdir(d)) != NULL) {
+		if (de->d_name[0] == '.')
+			continue;
+		snprintf(name, sizeof(name), "%s/%s", dir, de->d_name);
+		if (stat(name, &sb) != 0 || ! S_ISDIR(sb.st_mode))
+			continue;
+		ath3k_pin_scan_dir(name);
+	}
+	closedir(d);
+}
+
+/* Most recently used first */
+static int
+ath3k_pin_cmp(const void *a, const void *b)
+{
+	const struct ath3k_pin_file *fa = a, *fb = b;
+
+	if (fa->atime != fb->atime)
+		return (fa->atime < fb->atime ? 1 : -1);
+	return (strcmp(fa->name, fb->name));
+}
+
+/*
+ * Rescan and re-rank the images, pinning from the most recently used
+ * down until the cap is reached and unpinning the rest.
+ *
+ * Returns the number of images evicted.
+ */
+static int
+ath3k_pin_rescan(const char *fw_path, size_t cap)
+{
+	struct ath3k_pin_file *f;
+	char dir[FILENAME_MAX];
+	size_t used = 0, len;
+	int i, n, evicted = 0;
+
+	for (i = 0; i < ath3k_pin_nfiles; i++)
+		ath3k_pin_files[i].seen = 0;
+
+	ath3k_pin_scan_dir(fw_path);
+	snprintf(dir, sizeof(dir), "%s/ar3k", fw_path);
+	ath3k_pin_scan_dir(dir);
+	ath3k_pin_scan_subdirs(dir);
+
+	/* Drop whatever has gone away */
+	for (i = 0, n = 0; i < ath3k_pin_nfiles; i++) {
+		f = &ath3k_pin_files[i];
+		if (! f->seen) {
+			ath3k_pin_unpin(f);
+			continue;
+		}
+		if (n != i)
+			ath3k_pin_files[n] = *f;
+		n++;
+	}
+	ath3k_pin_nfiles = n;
+
+	/* The mappings stay valid across the sort; they're just pointers */
+	qsort(ath3k_pin_files, ath3k_pin_nfiles, sizeof(ath3k_pin_files[0]),
+	    ath3k_pin_cmp);
+
+	/*
+	 * Unlock what no longer makes the cut before locking anything
+	 * new, so we never go over the cap.
+	 */
+	for (i = 0; i < ath3k_pin_nfiles; i++) {
+		f = &ath3k_pin_files[i];
+		len = (f->size + ath3k_pin_pagesize - 1) &
+		    ~(ath3k_pin_pagesize - 1);
+		f->want = (used + len <= cap);
+		if (f->want)
+			used += len;
+		else if (f->map != NULL) {
+			ath3k_pin_unpin(f);
+			evicted++;
+		}
+	}
+	for (i = 0; i < ath3k_pin_nfiles; i++) {
+		f = &ath3k_pin_files[i];
+		if (f->want && f->map == NULL)
+			(void) ath3k_pin_pin(f);
+	}
+	return (evicted);
+}
+
+/*
+ * How much of what we hold is actually in memory.  It should be all
+ * of it; less means the mlock() limit was hit or the pages haven't
+ * been faulted in yet.
+ */
+static void
+ath3k_pin_report(size_t cap, int evicted)
+{
+	struct ath3k_pin_file *f;
+	unsigned char *vec;
+	size_t npages, pinned = 0, resident = 0, j;
+	int i, nfiles = 0;
+
+	for (i = 0; i < ath3k_pin_nfiles; i++) {
+		f = &ath3k_pin_files[i];
+		if (f->map == NULL)
+			continue;
+		nfiles++;
+		npages = (f->maplen + ath3k_pin_pagesize - 1) /
+		    ath3k_pin_pagesize;
+		pinned += npages * ath3k_pin_pagesize;
+		vec = malloc(npages);
+		if (vec == NULL)
+			continue;
+		if (mincore(f->map, f->maplen, (void *) vec) == 0) {
+			for (j = 0; j < npages; j++) {
+				if (vec[j] & 1)
+					resident += ath3k_pin_pagesize;
+			}
+		}
+		free(vec);
+	}
+
+	ath3k_info("pin: %d of %d images, %zu KB pinned of %zu KB, "
+	    "%zu KB resident, %d evicted\n",
+	    nfiles,
+	    ath3k_pin_nfiles,
+	    pinned / 1024,
+	    cap / 1024,
+	    resident / 1024,
+	    evicted);
+	fflush(stdout);
+}
+
+static void
+ath3k_pin_sighup(int sig __unused)
+{
+
+	ath3k_pin_hup = 1;
+}
+
+/*
+ * Hold the images under fw_path resident, using at most cap bytes,
+ * until killed.
+ *
+ * Returns 0 if it couldn't get started.
+ */
+int
+ath3k_pin_run(const char *fw_path, size_t cap)
+{
+	struct sigaction sa;
+	int evicted;
+
+	ath3k_pin_pagesize = sysconf(_SC_PAGESIZE);
+
+	bzero(&sa, sizeof(sa));
+	sa.sa_handler = ath3k_pin_sighup;
+	sigemptyset(&sa.sa_mask);
+	if (sigaction(SIGHUP, &sa, NULL) != 0) {
+		warn("%s: sigaction", __func__);
+		return (0);
+	}
+
+	for (;;) {
+		ath3k_pin_hup = 0;
+		evicted = ath3k_pin_rescan(fw_path, cap);
+		ath3k_pin_report(cap, evicted);
+
+		/* A SIGHUP cuts the sleep short */
+		if (! ath3k_pin_hup)
+			(void) sleep(ATH3K_PIN_INTERVAL);
+	}
+	/* NOTREACHED */
+}
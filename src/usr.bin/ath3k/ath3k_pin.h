@@ -0,0 +1,57 @@
+/*-
+ * Copyright (c) 2013 Adrian Chadd <adrian@freebsd.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer,
+ *    without modification.
+ * 2. Redistributions in binary form must reproduce at minimum a disclaimer
+ *    similar to the "NO WARRANTY" disclaimer below ("Disclaimer") and any
+ *    redistribution must be conditioned upon including a substantially
+ *    similar Disclaimer requirement for further binary redistribution.
+ *
+ * NO WARRANTY
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF NONINFRINGEMENT, MERCHANTIBILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGES.
+ *
+ * $FreeBSD$
+ */
+#ifndef	__ATH3K_PIN_H__
+#define	__ATH3K_PIN_H__
+
+/*
+ * Keeping the firmware images resident (-K).
+ *
+ * Each load is a fresh process, so the images (and the .pst and
+ * RamPatch.txt sources under ar3k/<rom>/) are only as warm as
+ * the page cache; under memory pressure the next hotplug can end up
+ * waiting on flash.  ath3k_pin_run() sits in the background holding
+ * the most recently used images mapped and mlock()ed, up to a cap,
+ * and rescans every ATH3K_PIN_INTERVAL seconds (or on SIGHUP).  The
+ * least recently used images are unlocked first when they don't all
+ * fit.  "Recently used" is the file's atime, which the loader bumps
+ * itself via ath3k_pin_touch() so it works on relatime mounts too.
+ */
+
+#define	ATH3K_PIN_MAX_FILES		64
+#define	ATH3K_PIN_INTERVAL		60	/* seconds */
+#define	ATH3K_PIN_STAMP_SEC		60	/* atime granularity */
+
+struct stat;
+
+extern	void ath3k_pin_touch(int fd, const struct stat *sb);
+extern	int ath3k_pin_run(const char *fw_path, size_t cap);
+
+#endif
@@ -0,0 +1,232 @@
+/*-
+ * Copyright (c) 2013 Adrian Chadd <adrian@freebsd.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer,
+ *    without modification.
+ * 2. Redistributions in binary form must reproduce at minimum a disclaimer
+ *    similar to the "NO WARRANTY" disclaimer below ("Disclaimer") and any
+ *    redistribution must be conditioned upon including a substantially
+ *    similar Disclaimer requirement for further binary redistribution.
+ *
+ * NO WARRANTY
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF NONINFRINGEMENT, MERCHANTIBILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGES.
+ *
+ * $FreeBSD$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <err.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#ifdef	__linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#include "ath3k_prof.h"
+#include "ath3k_time.h"
+#include "ath3k_dbg.h"
+
+enum {
+	ATH3K_PROF_WALL = 0,
+	ATH3K_PROF_UTIME,
+	ATH3K_PROF_STIME,
+	ATH3K_PROF_CSW,
+	ATH3K_PROF_CACHE_MISSES,
+	ATH3K_PROF_INSNS,
+	ATH3K_PROF_NVALS
+};
+
+struct ath3k_prof_seg {
+	const char	*name;
+	uint64_t	val[ATH3K_PROF_NVALS];
+};
+
+int ath3k_prof_enabled = 0;
+
+static struct ath3k_prof_seg ath3k_prof_segs[ATH3K_PROF_MAX_SEGS];
+static int ath3k_prof_nsegs = 0;
+static struct ath3k_prof_seg *ath3k_prof_cur = NULL;
+static uint64_t ath3k_prof_last[ATH3K_PROF_NVALS];
+
+/* perf counter fds, for ATH3K_PROF_CACHE_MISSES onwards; -1 if none */
+static int ath3k_prof_fd[ATH3K_PROF_NVALS] = { -1, -1, -1, -1, -1, -1 };
+
+#ifdef	__linux__
+static int
+ath3k_prof_perf_open(uint32_t type, uint64_t config)
+{
+	struct perf_event_attr attr;
+	int fd;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.exclude_hv = 1;
+
+	/* This thread, any CPU */
+	fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+
+	/*
+	 * Unprivileged users usually can't count kernel events
+	 * (perf_event_paranoid >= 2); fall back to userland only.
+	 */
+	if (fd < 0 && (errno == EACCES || errno == EPERM)) {
+		attr.exclude_kernel = 1;
+		fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+		if (fd >= 0)
+			ath3k_debug("%s: counting userland only\n",
+			    __func__);
+	}
+	return (fd);
+}
+#endif
+
+static void
+ath3k_prof_sample(uint64_t *val)
+{
+	struct rusage ru;
+	uint64_t v;
+	int i;
+
+	val[ATH3K_PROF_WALL] = ath3k_time_usec();
+#ifdef	RUSAGE_THREAD
+	(void) getrusage(RUSAGE_THREAD, &ru);
+#else
+	(void) getrusage(RUSAGE_SELF, &ru);
+#endif
+	val[ATH3K_PROF_UTIME] = (uint64_t) ru.ru_utime.tv_sec * 1000000ULL +
+	    ru.ru_utime.tv_usec;
+	val[ATH3K_PROF_STIME] = (uint64_t) ru.ru_stime.tv_sec * 1000000ULL +
+	    ru.ru_stime.tv_usec;
+	val[ATH3K_PROF_CSW] = ru.ru_nvcsw + ru.ru_nivcsw;
+
+	for (i = ATH3K_PROF_CACHE_MISSES; i < ATH3K_PROF_NVALS; i++) {
+		if (ath3k_prof_fd[i] < 0 ||
+		    read(ath3k_prof_fd[i], &v, sizeof(v)) != sizeof(v))
+			v = 0;
+		val[i] = v;
+	}
+}
+
+/*
+ * Open the counters and start the clock.
+ *
+ * Returns 1 if OK, 0 on error.
+ */
+int
+ath3k_prof_init(void)
+{
+
+#ifdef	__linux__
+	ath3k_prof_fd[ATH3K_PROF_CACHE_MISSES] = ath3k_prof_perf_open(
+	    PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+	ath3k_prof_fd[ATH3K_PROF_INSNS] = ath3k_prof_perf_open(
+	    PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+	if (ath3k_prof_fd[ATH3K_PROF_CACHE_MISSES] < 0)
+		warn("%s: perf_event_open; no hardware counters", __func__);
+#endif
+	ath3k_prof_enabled = 1;
+	ath3k_prof_sample(ath3k_prof_last);
+	return (1);
+}
+
+/*
+ * Charge everything since the last call to the running segment, then
+ * start charging to name.  NULL just stops the clock.
+ */
+void
+ath3k_prof_begin(const char *name)
+{
+	uint64_t now[ATH3K_PROF_NVALS];
+	int i;
+
+	if (! ath3k_prof_enabled)
+		return;
+
+	ath3k_prof_sample(now);
+	if (ath3k_prof_cur != NULL) {
+		for (i = 0; i < ATH3K_PROF_NVALS; i++)
+			ath3k_prof_cur->val[i] += now[i] - ath3k_prof_last[i];
+	}
+	memcpy(ath3k_prof_last, now, sizeof(now));
+
+	ath3k_prof_cur = NULL;
+	if (name == NULL)
+		return;
+	for (i = 0; i < ath3k_prof_nsegs; i++) {
+		if (strcmp(ath3k_prof_segs[i].name, name) == 0) {
+			ath3k_prof_cur = &ath3k_prof_segs[i];
+			return;
+		}
+	}
+	if (ath3k_prof_nsegs < ATH3K_PROF_MAX_SEGS) {
+		ath3k_prof_cur = &ath3k_prof_segs[ath3k_prof_nsegs++];
+		ath3k_prof_cur->name = name;
+	}
+}
+
+/*
+ * Stop the clock and print the per segment cost table.
+ */
+void
+ath3k_prof_report(void)
+{
+	const struct ath3k_prof_seg *s;
+	struct ath3k_prof_seg total;
+	int i, j;
+
+	if (! ath3k_prof_enabled)
+		return;
+	ath3k_prof_begin(NULL);
+
+	memset(&total, 0, sizeof(total));
+	total.name = "total";
+
+	printf("%-16s %10s %10s %10s %6s %12s %12s\n",
+	    "phase", "wall us", "user us", "sys us", "csw",
+	    "cache miss", "insns");
+	for (i = 0; i <= ath3k_prof_nsegs; i++) {
+		s = (i < ath3k_prof_nsegs) ? &ath3k_prof_segs[i] : &total;
+		printf("%-16s %10llu %10llu %10llu %6llu",
+		    s->name,
+		    (unsigned long long) s->val[ATH3K_PROF_WALL],
+		    (unsigned long long) s->val[ATH3K_PROF_UTIME],
+		    (unsigned long long) s->val[ATH3K_PROF_STIME],
+		    (unsigned long long) s->val[ATH3K_PROF_CSW]);
+		for (j = ATH3K_PROF_CACHE_MISSES; j < ATH3K_PROF_NVALS; j++) {
+			if (ath3k_prof_fd[j] < 0)
+				printf(" %12s", "-");
+			else
+				printf(" %12llu",
+				    (unsigned long long) s->val[j]);
+		}
+		printf("\n");
+		if (s == &total)
+			break;
+		for (j = 0; j < ATH3K_PROF_NVALS; j++)
+			total.val[j] += s->val[j];
+	}
+}
@@ -0,0 +1,822 @@
+/*-
+ * Copyright (c) 2013 Adrian Chadd <adrian@freebsd.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer,
+ *    without modification.
+ * 2. Redistributions in binary form must reproduce at minimum a disclaimer
+ *    similar to the "NO WARRANTY" disclaimer below ("Disclaimer") and any
+ *    redistribution must be conditioned upon including a substantially
+ *    similar Disclaimer requirement for further binary redistribution.
+ *
+ * NO WARRANTY
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF NONINFRINGEMENT, MERCHANTIBILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGES.
+ *
+ * $FreeBSD$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <ctype.h>
+#include <err.h>
+#include <sys/param.h>
+
+#include "ath3k_fw.h"
+#include "ath3k_arena.h"
+#include "ath3k_metrics.h"
+#include "ath3k_ps.h"
+#include "ath3k_bdaddr.h"
+#include "ath3k_dbg.h"
+
+/*
+ * The .pst text format is a sequence of entries, each introduced
+ * by a '#' line:
+ *
+ * // comment
+ * #
+ * [H:S]0013		<- tag id (hex)
+ * [H:S]0004		<- tag length (hex)
+ * [H:A]01 02 03	<- tag data, hex bytes, may span lines
+ *      04
+ *
+ * Some files leave out the [H:A] and just start the hex bytes on
+ * the line after the tag length.
+ */
+
+/*
+ * Compiled syscfg images are kept here between runs, named for an
+ * FNV-1a hash of the .pst contents and the load address, so a given
+ * configuration is only parsed once however many devices (or runs)
+ * load it.  It's only used if the directory exists; NULL turns it
+ * off.
+ */
+const char *ath3k_ps_cache_dir = ATH3K_PS_CACHE_DIR;
+
+static struct ath3k_ps_override ath3k_ps_overrides[ATH3K_PS_MAX_OVERRIDES];
+static int ath3k_ps_noverrides = 0;
+
+/*
+ * Syscfg load address, by ROM version.
+ */
+static const struct {
+	uint32_t	rom_version;
+	uint32_t	load_addr;
+} ath3k_ps_addr_list[] = {
+	{ 0x01020001, 0x00591800 },
+	{ 0x01020200, 0x00593000 },
+	{ 0x01020201, 0x00593000 },
+	{ 0x11020000, 0x00593800 },
+	{ 0x31010000, 0x00593800 },
+};
+
+uint32_t
+ath3k_ps_load_addr(uint32_t rom_version)
+{
+	int i;
+
+	for (i = 0; i < (int) nitems(ath3k_ps_addr_list); i++) {
+		if (ath3k_ps_addr_list[i].rom_version == rom_version)
+			return (ath3k_ps_addr_list[i].load_addr);
+	}
+	return (0);
+}
+
+static uint64_t
+ath3k_ps_hash(const unsigned char *buf, int len)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;	/* FNV-1a */
+	int i;
+
+	for (i = 0; i < len; i++) {
+		h ^= buf[i];
+		h *= 0x100000001b3ULL;
+	}
+	return (h);
+}
+
+static int
+ath3k_ps_hexval(int c)
+{
+
+	if (c >= '0' && c <= '9')
+		return (c - '0');
+	if (c >= 'a' && c <= 'f')
+		return (c - 'a' + 10);
+	if (c >= 'A' && c <= 'F')
+		return (c - 'A' + 10);
+	return (-1);
+}
+
+static void
+ath3k_ps_release(unsigned char *p)
+{
+
+	if (p == NULL)
+		return;
+	if (ath3k_arena_owns(p))
+		ath3k_arena_release(p);
+	else
+		free(p);
+}
+
+/*
+ * The tag data comes out of the arena like the images do, falling
+ * back to the (counted) heap if it won't fit.
+ */
+static int
+ath3k_ps_append(struct ath3k_ps *ps, unsigned char val)
+{
+	unsigned char *n;
+	int size;
+
+	if (ps->len == ps->size) {
+		size = ps->size ? ps->size * 2 : 1024;
+		n = ath3k_arena_alloc(size);
+		if (n == NULL) {
+			n = malloc(size);
+			if (n == NULL) {
+				warn("%s: malloc", __func__);
+				return (-1);
+			}
+			ath3k_counter_add(ATH3K_CTR_HEAP_ALLOCS, 1);
+		}
+		if (ps->len != 0)
+			memcpy(n, ps->data, ps->len);
+		ath3k_ps_release(ps->data);
+		ps->data = n;
+		ps->size = size;
+	}
+	ps->data[ps->len++] = val;
+	return (0);
+}
+
+/*
+ * Close off the current entry, checking it's complete and padding
+ * the data out to the declared length.
+ */
+static int
+ath3k_ps_finish(struct ath3k_ps *ps, int nfields, int lineno)
+{
+	struct ath3k_ps_tag *t;
+	int have;
+
+	if (nfields == 0)
+		return (0);
+
+	t = &ps->tags[ps->ntags];
+	if (nfields != 2) {
+		ath3k_err("%s: line %d: entry is missing its tag length\n",
+		    __func__,
+		    lineno);
+		return (-1);
+	}
+
+	have = ps->len - t->off;
+	if (have > t->len) {
+		ath3k_err("%s: line %d: tag 0x%04x has %d bytes, expected %d\n",
+		    __func__,
+		    lineno,
+		    t->id,
+		    have,
+		    t->len);
+		return (-1);
+	}
+	for (; have < t->len; have++) {
+		if (ath3k_ps_append(ps, 0) != 0)
+			return (-1);
+	}
+
+	ps->ntags++;
+	return (0);
+}
+
+/*
+ * Parse a .pst file's contents.
+ *
+ * Returns 1 on success, 0 on error.
+ */
+int
+ath3k_ps_parse(struct ath3k_ps *ps, const char *buf, int len)
+{
+	const char *p, *eol, *end;
+	struct ath3k_ps_tag *t;
+	int lineno = 0, nfields = 0;
+	int hi, lo;
+	unsigned long v;
+	char *ep;
+
+	bzero(ps, sizeof(*ps));
+	end = buf + len;
+
+	for (p = buf; p < end; p = eol + 1) {
+		lineno++;
+		eol = memchr(p, '\n', end - p);
+		if (eol == NULL)
+			eol = end;
+
+		/* Strip comments and leading white space */
+		while (p < eol && isspace((unsigned char) *p))
+			p++;
+		if (eol - p >= 2 && p[0] == '/' && p[1] == '/')
+			continue;
+		if (p == eol)
+			continue;
+
+		if (*p == '#') {
+			if (ath3k_ps_finish(ps, nfields, lineno) != 0)
+				goto fail;
+			nfields = 0;
+			continue;
+		}
+
+		if (eol - p >= 5 && strncmp(p, "[H:S]", 5) == 0) {
+			if (nfields >= 2) {
+				ath3k_err("%s: line %d: unexpected [H:S]\n",
+				    __func__,
+				    lineno);
+				goto fail;
+			}
+			if (ps->ntags >= ATH3K_PS_MAX_TAGS) {
+				ath3k_err("%s: line %d: too many tags\n",
+				    __func__,
+				    lineno);
+				goto fail;
+			}
+			v = strtoul(p + 5, &ep, 16);
+			if (ep == p + 5 || v > ATH3K_PS_MAX_TAG_LEN) {
+				ath3k_err("%s: line %d: bad value\n",
+				    __func__,
+				    lineno);
+				goto fail;
+			}
+			t = &ps->tags[ps->ntags];
+			if (nfields == 0) {
+				t->id = v;
+			} else {
+				t->len = v;
+				t->off = ps->len;
+			}
+			nfields++;
+			continue;
+		}
+
+		if (eol - p >= 5 && strncmp(p, "[H:A]", 5) == 0) {
+			if (nfields != 2) {
+				ath3k_err("%s: line %d: data before tag "
+				    "id/length\n",
+				    __func__,
+				    lineno);
+				goto fail;
+			}
+			p += 5;
+		} else if (nfields != 2) {
+			ath3k_err("%s: line %d: unexpected text\n",
+			    __func__,
+			    lineno);
+			goto fail;
+		}
+
+		/* Hex bytes, white space separated */
+		while (p < eol) {
+			if (isspace((unsigned char) *p)) {
+				p++;
+				continue;
+			}
+			if (p[0] == '/' && p + 1 < eol && p[1] == '/')
+				break;
+			hi = ath3k_ps_hexval(p[0]);
+			lo = (p + 1 < eol) ? ath3k_ps_hexval(p[1]) : -1;
+			if (hi < 0 || lo < 0) {
+				ath3k_err("%s: line %d: bad hex byte\n",
+				    __func__,
+				    lineno);
+				goto fail;
+			}
+			if (ath3k_ps_append(ps, (hi << 4) | lo) != 0)
+				goto fail;
+			p += 2;
+		}
+	}
+
+	if (ath3k_ps_finish(ps, nfields, lineno) != 0)
+		goto fail;
+
+	return (1);
+
+fail:
+	ath3k_ps_free(ps);
+	return (0);
+}
+
+void
+ath3k_ps_free(struct ath3k_ps *ps)
+{
+
+	ath3k_ps_release(ps->data);
+	bzero(ps, sizeof(*ps));
+}
+
+static void
+ath3k_ps_put16(unsigned char *p, uint16_t v)
+{
+
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+}
+
+static void
+ath3k_ps_put32(unsigned char *p, uint32_t v)
+{
+
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+	p[2] = (v >> 16) & 0xff;
+	p[3] = (v >> 24) & 0xff;
+}
+
+/*
+ * Compile parsed PS tags into a syscfg image, laid out as the
+ * shipped ramps_0x*.dfu files are:
+ *
+ * + firmware header: load address, 0xffffffff, payload length,
+ *   0, 2 (32 bits each);
+ * + payload header: magic, 0x0c, payload length - 12, 0 (32 bits
+ *   each), then 0, tag bytes + 0x100, tag bytes (16 bits each);
+ * + each tag: id, length (16 bits each), data.
+ *
+ * Everything is little endian.
+ *
+ * Returns 1 on success, 0 on error.
+ */
+int
+ath3k_ps_compile(const struct ath3k_ps *ps, uint32_t load_addr,
+    struct ath3k_firmware *fw)
+{
+	unsigned char *buf, *p;
+	int i, taglen = 0, plen, len;
+
+	for (i = 0; i < ps->ntags; i++)
+		taglen += ATH3K_PS_TAG_HDR_SIZE + ps->tags[i].len;
+	if (taglen + 0x100 > 0xffff) {
+		ath3k_err("%s: %d bytes of tags is too large\n",
+		    __func__,
+		    taglen);
+		return (0);
+	}
+
+	plen = ATH3K_PS_HDR_SIZE + taglen;
+	len = FW_HDR_SIZE + plen;
+
+	bzero(fw, sizeof(*fw));
+	if (ath3k_fw_alloc(fw, len) == 0)
+		return (0);
+
+	buf = fw->buf;
+	p = buf;
+	ath3k_ps_put32(p, load_addr);
+	ath3k_ps_put32(p + 4, 0xffffffff);
+	ath3k_ps_put32(p + 8, plen);
+	ath3k_ps_put32(p + 16, 2);
+	p += FW_HDR_SIZE;
+
+	ath3k_ps_put32(p, ATH3K_PS_MAGIC);
+	ath3k_ps_put32(p + 4, 0x0c);
+	ath3k_ps_put32(p + 8, plen - 12);
+	ath3k_ps_put16(p + 18, taglen + 0x100);
+	ath3k_ps_put16(p + 20, taglen);
+	p += ATH3K_PS_HDR_SIZE;
+
+	for (i = 0; i < ps->ntags; i++) {
+		ath3k_ps_put16(p, ps->tags[i].id);
+		ath3k_ps_put16(p + 2, ps->tags[i].len);
+		memcpy(p + ATH3K_PS_TAG_HDR_SIZE, ps->data + ps->tags[i].off,
+		    ps->tags[i].len);
+		p += ATH3K_PS_TAG_HDR_SIZE + ps->tags[i].len;
+	}
+
+	fw->len = len;
+	return (1);
+}
+
+static uint32_t
+ath3k_ps_get32(const unsigned char *p)
+{
+
+	return (p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24));
+}
+
+/*
+ * Name the cache file for a .pst; returns 0 if there's no cache.
+ */
+static int
+ath3k_ps_cache_name(char *buf, int len, const struct ath3k_firmware *src,
+    uint32_t load_addr)
+{
+
+	if (ath3k_ps_cache_dir == NULL ||
+	    access(ath3k_ps_cache_dir, R_OK | X_OK) != 0)
+		return (0);
+	return (snprintf(buf, len, "%s/ps_%016jx_%08x.dfu",
+	    ath3k_ps_cache_dir,
+	    (uintmax_t) ath3k_ps_hash(src->buf, src->len),
+	    load_addr) < len);
+}
+
+/*
+ * Read a cached image, if there is one and it looks like what
+ * ath3k_ps_compile() would have made.
+ */
+static int
+ath3k_ps_cache_read(struct ath3k_firmware *fw, const char *name,
+    uint32_t load_addr)
+{
+	const unsigned char *p;
+
+	if (access(name, R_OK) != 0)
+		return (0);
+	if (ath3k_fw_read(fw, name) <= 0)
+		return (0);
+
+	p = fw->buf;
+	if (fw->len < FW_HDR_SIZE + ATH3K_PS_HDR_SIZE ||
+	    ath3k_ps_get32(p) != load_addr ||
+	    ath3k_ps_get32(p + 8) != (uint32_t) (fw->len - FW_HDR_SIZE) ||
+	    ath3k_ps_get32(p + FW_HDR_SIZE) != ATH3K_PS_MAGIC) {
+		ath3k_info("%s: %s: not a syscfg image; ignoring it\n",
+		    __func__,
+		    name);
+		ath3k_fw_free(fw);
+		return (0);
+	}
+	return (1);
+}
+
+/*
+ * Save a freshly compiled image.  Failing to is only worth a
+ * mention; the image itself is fine.
+ */
+static void
+ath3k_ps_cache_write(const struct ath3k_firmware *fw, const char *name)
+{
+
+	if (access(ath3k_ps_cache_dir, W_OK) != 0) {
+		ath3k_debug("%s: %s isn't writable; not caching\n",
+		    __func__,
+		    ath3k_ps_cache_dir);
+		return;
+	}
+	if (ath3k_fw_write(fw, name) == 0)
+		ath3k_info("%s: couldn't cache %s\n", __func__, name);
+}
+
+/*
+ * Read a .pst file and compile it into a syscfg image for the
+ * given ROM version, or fetch the image compiled from the same
+ * contents last time from the cache.
+ *
+ * Returns 1 on success, 0 on error.
+ */
+int
+ath3k_ps_load(struct ath3k_firmware *fw, const char *psname,
+    uint32_t rom_version)
+{
+	struct ath3k_firmware src;
+	struct ath3k_ps ps;
+	char cname[FILENAME_MAX];
+	uint32_t load_addr;
+	int cached, ret;
+
+	load_addr = ath3k_ps_load_addr(rom_version);
+	if (load_addr == 0) {
+		ath3k_err("%s: no syscfg load address for ROM 0x%08x\n",
+		    __func__,
+		    rom_version);
+		return (0);
+	}
+
+	if (ath3k_fw_read(&src, psname) <= 0)
+		return (0);
+
+	cached = ath3k_ps_cache_name(cname, sizeof(cname), &src, load_addr);
+	if (cached && ath3k_ps_cache_read(fw, cname, load_addr)) {
+		ath3k_debug("%s: %s: cached as %s\n",
+		    __func__,
+		    psname,
+		    cname);
+		ret = 1;
+		goto done;
+	}
+
+	ret = ath3k_ps_parse(&ps, (const char *) src.buf, src.len);
+	if (ret == 0) {
+		ath3k_err("%s: %s: parse failed\n", __func__, psname);
+		goto done;
+	}
+
+	ath3k_debug("%s: %s: %d tags, %d bytes\n",
+	    __func__,
+	    psname,
+	    ps.ntags,
+	    ps.len);
+
+	ret = ath3k_ps_compile(&ps, load_addr, fw);
+	ath3k_ps_free(&ps);
+	if (ret && cached)
+		ath3k_ps_cache_write(fw, cname);
+
+done:
+	if (ret)
+		snprintf(fw->fwname, sizeof(fw->fwname), "%s", psname);
+	ath3k_fw_free(&src);
+	return (ret);
+}
+
+static uint16_t
+ath3k_ps_get16(const unsigned char *p)
+{
+
+	return (p[0] | (p[1] << 8));
+}
+
+/*
+ * Find a tag in a compiled syscfg image.
+ *
+ * Returns the offset of the tag data (and its length in *len), or
+ * -1 if it isn't there.
+ */
+int
+ath3k_ps_find_tag(const struct ath3k_firmware *fw, uint16_t id, int *len)
+{
+	int off, tlen;
+
+	off = FW_HDR_SIZE + ATH3K_PS_HDR_SIZE;
+	while (off + ATH3K_PS_TAG_HDR_SIZE <= fw->len) {
+		tlen = ath3k_ps_get16(fw->buf + off + 2);
+		if (ath3k_ps_get16(fw->buf + off) == id) {
+			if (off + ATH3K_PS_TAG_HDR_SIZE + tlen > fw->len)
+				break;
+			*len = tlen;
+			return (off + ATH3K_PS_TAG_HDR_SIZE);
+		}
+		off += ATH3K_PS_TAG_HDR_SIZE + tlen;
+	}
+	return (-1);
+}
+
+/*
+ * Append a tag to a compiled syscfg image, fixing up the lengths
+ * in the headers.
+ *
+ * Returns the offset of the new tag data, or -1 on error.
+ */
+int
+ath3k_ps_add_tag(struct ath3k_firmware *fw, uint16_t id,
+    const unsigned char *data, int len)
+{
+	unsigned char *p;
+	int plen, taglen, off;
+
+	if (fw->len < FW_HDR_SIZE + ATH3K_PS_HDR_SIZE) {
+		ath3k_err("%s: %s: not a syscfg image\n",
+		    __func__,
+		    fw->fwname);
+		return (-1);
+	}
+
+	p = fw->buf + FW_HDR_SIZE;
+	taglen = ath3k_ps_get16(p + 20) + ATH3K_PS_TAG_HDR_SIZE + len;
+	plen = fw->len - FW_HDR_SIZE + ATH3K_PS_TAG_HDR_SIZE + len;
+	if (taglen + 0x100 > 0xffff) {
+		ath3k_err("%s: image too large\n", __func__);
+		return (-1);
+	}
+
+	if (ath3k_fw_grow(fw, FW_HDR_SIZE + plen) == 0)
+		return (-1);
+
+	off = fw->len;
+	ath3k_ps_put16(fw->buf + off, id);
+	ath3k_ps_put16(fw->buf + off + 2, len);
+	memcpy(fw->buf + off + ATH3K_PS_TAG_HDR_SIZE, data, len);
+	fw->len = FW_HDR_SIZE + plen;
+
+	p = fw->buf;
+	ath3k_ps_put32(p + 8, plen);
+	p += FW_HDR_SIZE;
+	ath3k_ps_put32(p + 8, plen - 12);
+	ath3k_ps_put16(p + 18, taglen + 0x100);
+	ath3k_ps_put16(p + 20, taglen);
+
+	return (off + ATH3K_PS_TAG_HDR_SIZE);
+}
+
+/*
+ * Give this device its own BD_ADDR (most significant byte first)
+ * by overlaying the BD_ADDR tag; the image itself is only changed
+ * if it doesn't have one yet.
+ *
+ * Returns 1 on success, 0 on error.
+ */
+int
+ath3k_ps_set_bdaddr(struct ath3k_firmware *fw, const uint8_t *bdaddr)
+{
+	unsigned char le[ATH3K_BDADDR_LEN];
+	int i, off, len;
+
+	/* The tag holds it least significant byte first */
+	for (i = 0; i < ATH3K_BDADDR_LEN; i++)
+		le[i] = bdaddr[ATH3K_BDADDR_LEN - 1 - i];
+
+	off = ath3k_ps_find_tag(fw, ATH3K_PS_TAG_BDADDR, &len);
+
+	/* No tag to overlay; add one */
+	if (off < 0)
+		return (ath3k_ps_add_tag(fw, ATH3K_PS_TAG_BDADDR, le,
+		    ATH3K_BDADDR_LEN) >= 0);
+
+	if (len != ATH3K_BDADDR_LEN) {
+		ath3k_err("%s: %s: BD_ADDR tag is %d bytes\n",
+		    __func__,
+		    fw->fwname,
+		    len);
+		return (0);
+	}
+
+	return (ath3k_fw_overlay_add(fw, off, le, ATH3K_BDADDR_LEN));
+}
+
+/*
+ * Index the tags in a compiled syscfg image.
+ */
+void
+ath3k_ps_index_build(const struct ath3k_firmware *fw,
+    struct ath3k_ps_index *idx)
+{
+	struct ath3k_ps_tag *t;
+	int off, tlen;
+
+	idx->ntags = 0;
+	off = FW_HDR_SIZE + ATH3K_PS_HDR_SIZE;
+	while (off + ATH3K_PS_TAG_HDR_SIZE <= fw->len &&
+	    idx->ntags < ATH3K_PS_MAX_TAGS) {
+		tlen = ath3k_ps_get16(fw->buf + off + 2);
+		if (off + ATH3K_PS_TAG_HDR_SIZE + tlen > fw->len)
+			break;
+		t = &idx->tags[idx->ntags++];
+		t->id = ath3k_ps_get16(fw->buf + off);
+		t->len = tlen;
+		t->off = off + ATH3K_PS_TAG_HDR_SIZE;
+		off += ATH3K_PS_TAG_HDR_SIZE + tlen;
+	}
+}
+
+/*
+ * Parse a tag override, "tag[@offset]=hexbytes", with "&=" or "|="
+ * to clear or set bits instead.  The tag and offset are hex.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+ath3k_ps_override_add(const char *spec)
+{
+	struct ath3k_ps_override *o;
+	const char *p;
+	char *ep;
+	unsigned long v;
+	int hi, lo;
+
+	if (ath3k_ps_noverrides >= ATH3K_PS_MAX_OVERRIDES) {
+		ath3k_err("%s: too many overrides\n", __func__);
+		return (-1);
+	}
+	o = &ath3k_ps_overrides[ath3k_ps_noverrides];
+	bzero(o, sizeof(*o));
+
+	v = strtoul(spec, &ep, 16);
+	if (ep == spec || v > 0xffff)
+		return (-1);
+	o->id = v;
+
+	if (*ep == '@') {
+		p = ep + 1;
+		v = strtoul(p, &ep, 16);
+		if (ep == p || v > ATH3K_PS_MAX_TAG_LEN)
+			return (-1);
+		o->off = v;
+	}
+
+	switch (*ep) {
+	case '&':
+		o->op = ATH3K_PS_OP_AND;
+		ep++;
+		break;
+	case '|':
+		o->op = ATH3K_PS_OP_OR;
+		ep++;
+		break;
+	default:
+		o->op = ATH3K_PS_OP_SET;
+		break;
+	}
+	if (*ep != '=')
+		return (-1);
+
+	for (p = ep + 1; *p != '\0'; p += 2) {
+		hi = ath3k_ps_hexval(p[0]);
+		lo = (p[1] != '\0') ? ath3k_ps_hexval(p[1]) : -1;
+		if (hi < 0 || lo < 0 || o->len >= ATH3K_FW_OVERLAY_LEN)
+			return (-1);
+		o->data[o->len++] = (hi << 4) | lo;
+	}
+	if (o->len == 0)
+		return (-1);
+
+	ath3k_ps_noverrides++;
+	return (0);
+}
+
+/*
+ * Apply the tag overrides to a compiled syscfg image, as overlays.
+ *
+ * Returns 1 on success, 0 on error.
+ */
+int
+ath3k_ps_override_apply(struct ath3k_firmware *fw)
+{
+	struct ath3k_ps_index idx;
+	struct ath3k_ps_override *o;
+	struct ath3k_ps_tag *t;
+	unsigned char buf[ATH3K_FW_OVERLAY_LEN];
+	int i, j;
+
+	if (ath3k_ps_noverrides == 0)
+		return (1);
+
+	ath3k_ps_index_build(fw, &idx);
+
+	for (i = 0; i < ath3k_ps_noverrides; i++) {
+		o = &ath3k_ps_overrides[i];
+		t = NULL;
+		for (j = 0; j < idx.ntags; j++) {
+			if (idx.tags[j].id == o->id) {
+				t = &idx.tags[j];
+				break;
+			}
+		}
+		if (t == NULL || o->off + o->len > t->len) {
+			ath3k_err("%s: %s: no tag 0x%04x bytes %d..%d\n",
+			    __func__,
+			    fw->fwname,
+			    o->id,
+			    o->off,
+			    o->off + o->len - 1);
+			return (0);
+		}
+
+		/* Combine with what's there, overlays included */
+		memcpy(buf, fw->buf + t->off + o->off, o->len);
+		ath3k_fw_overlay_apply(fw, t->off + o->off, buf, o->len);
+		for (j = 0; j < o->len; j++) {
+			switch (o->op) {
+			case ATH3K_PS_OP_AND:
+				buf[j] &= o->data[j];
+				break;
+			case ATH3K_PS_OP_OR:
+				buf[j] |= o->data[j];
+				break;
+			default:
+				buf[j] = o->data[j];
+				break;
+			}
+		}
+
+		ath3k_debug("%s: tag 0x%04x @%d: %d bytes\n",
+		    __func__,
+		    o->id,
+		    o->off,
+		    o->len);
+
+		if (ath3k_fw_overlay_add(fw, t->off + o->off, buf,
+		    o->len) == 0)
+			return (0);
+	}
+
+	return (1);
+}
@@ -0,0 +1,115 @@
+/*-
+ * Copyright (c) 2013 Adrian Chadd <adrian@freebsd.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer,
+ *    without modification.
+ * 2. Redistributions in binary form must reproduce at minimum a disclaimer
+ *    similar to the "NO WARRANTY" disclaimer below ("Disclaimer") and any
+ *    redistribution must be conditioned upon including a substantially
+ *    similar Disclaimer requirement for further binary redistribution.
+ *
+ * NO WARRANTY
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF NONINFRINGEMENT, MERCHANTIBILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGES.
+ *
+ * $FreeBSD$
+ */
+#ifndef	__ATH3K_PS_H__
+#define	__ATH3K_PS_H__
+
+/*
+ * Persistent store (PS) configuration, as shipped in the
+ * ar3k/<rev>/PS_ASIC.pst text files, and the syscfg (ramps) image
+ * format it is compiled into.
+ */
+
+#define	ATH3K_PS_MAX_TAGS		64
+#define	ATH3K_PS_MAX_TAG_LEN		0xffff
+
+#define	ATH3K_PS_TAG_BDADDR		0x0001
+
+/* Where compiled .pst images are cached, by default */
+#define	ATH3K_PS_CACHE_DIR		"/var/cache/ath3kfw"
+
+/* syscfg image layout */
+#define	ATH3K_PS_MAGIC			0xceedfaad
+#define	ATH3K_PS_HDR_SIZE		22	/* after FW_HDR_SIZE */
+#define	ATH3K_PS_TAG_HDR_SIZE		4
+
+struct ath3k_ps_tag {
+	uint16_t	id;
+	uint16_t	len;
+	int		off;		/* offset into ath3k_ps.data */
+};
+
+/*
+ * Where each tag's data lives in a compiled syscfg image, built
+ * once per image.
+ */
+struct ath3k_ps_index {
+	int		ntags;
+	struct ath3k_ps_tag tags[ATH3K_PS_MAX_TAGS];
+};
+
+/*
+ * A runtime change to a tag: tag[@offset]=bytes, &=bytes or |=bytes.
+ */
+#define	ATH3K_PS_MAX_OVERRIDES		16
+
+enum {
+	ATH3K_PS_OP_SET = 0,
+	ATH3K_PS_OP_AND,
+	ATH3K_PS_OP_OR
+};
+
+struct ath3k_ps_override {
+	uint16_t	id;
+	int		off;
+	int		op;
+	int		len;
+	unsigned char	data[ATH3K_FW_OVERLAY_LEN];
+};
+
+struct ath3k_ps {
+	int		ntags;
+	struct ath3k_ps_tag tags[ATH3K_PS_MAX_TAGS];
+	unsigned char	*data;
+	int		len;		/* data length */
+	int		size;		/* data buffer size */
+};
+
+extern	const char *ath3k_ps_cache_dir;
+
+extern	int ath3k_ps_parse(struct ath3k_ps *ps, const char *buf, int len);
+extern	void ath3k_ps_free(struct ath3k_ps *ps);
+extern	uint32_t ath3k_ps_load_addr(uint32_t rom_version);
+extern	int ath3k_ps_compile(const struct ath3k_ps *ps, uint32_t load_addr,
+	    struct ath3k_firmware *fw);
+extern	int ath3k_ps_load(struct ath3k_firmware *fw, const char *psname,
+	    uint32_t rom_version);
+extern	int ath3k_ps_find_tag(const struct ath3k_firmware *fw, uint16_t id,
+	    int *len);
+extern	int ath3k_ps_add_tag(struct ath3k_firmware *fw, uint16_t id,
+	    const unsigned char *data, int len);
+extern	void ath3k_ps_index_build(const struct ath3k_firmware *fw,
+	    struct ath3k_ps_index *idx);
+extern	int ath3k_ps_override_add(const char *spec);
+extern	int ath3k_ps_override_apply(struct ath3k_firmware *fw);
+extern	int ath3k_ps_set_bdaddr(struct ath3k_firmware *fw,
+	    const uint8_t *bdaddr);
+
+#endif
@@ -0,0 +1,314 @@
+/*-
+ * Copyright (c) 2013 Adrian Chadd <adrian@freebsd.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer,
+ *    without modification.
+ * 2. Redistributions in binary form must reproduce at minimum a disclaimer
+ *    similar to the "NO WARRANTY" disclaimer below ("Disclaimer") and any
+ *    redistribution must be conditioned upon including a substantially
+ *    similar Disclaimer requirement for further binary redistribution.
+ *
+ * NO WARRANTY
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF NONINFRINGEMENT, MERCHANTIBILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGES.
+ *
+ * $FreeBSD$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <ctype.h>
+#include <err.h>
+
+#ifdef	__SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "ath3k_fw.h"
+#include "ath3k_ps.h"
+#include "ath3k_rampatch.h"
+#include "ath3k_dbg.h"
+
+static int
+ath3k_hexval(int c)
+{
+
+	if (c >= '0' && c <= '9')
+		return (c - '0');
+	if (c >= 'a' && c <= 'f')
+		return (c - 'a' + 10);
+	if (c >= 'A' && c <= 'F')
+		return (c - 'A' + 10);
+	return (-1);
+}
+
+/*
+ * Decode len bytes from 2 * len hex digits.
+ *
+ * Returns 0 on success, or -1 on a bad digit.
+ */
+int
+ath3k_hex_decode_scalar(unsigned char *dst, const char *src, int len)
+{
+	int i, hi, lo;
+
+	for (i = 0; i < len; i++) {
+		hi = ath3k_hexval((unsigned char) src[2 * i]);
+		lo = ath3k_hexval((unsigned char) src[2 * i + 1]);
+		if (hi < 0 || lo < 0)
+			return (-1);
+		dst[i] = (hi << 4) | lo;
+	}
+	return (0);
+}
+
+#ifdef	__SSE2__
+/*
+ * Turn 16 hex digits into their nibble values; *ok is cleared if
+ * any of them isn't a hex digit.
+ */
+static inline __m128i
+ath3k_hex_nibbles(__m128i c, int *ok)
+{
+	__m128i lc, digit, alpha, v;
+
+	lc = _mm_or_si128(c, _mm_set1_epi8(0x20));
+	digit = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('0' - 1)),
+	    _mm_cmplt_epi8(c, _mm_set1_epi8('9' + 1)));
+	alpha = _mm_and_si128(_mm_cmpgt_epi8(lc, _mm_set1_epi8('a' - 1)),
+	    _mm_cmplt_epi8(lc, _mm_set1_epi8('f' + 1)));
+
+	v = _mm_or_si128(
+	    _mm_and_si128(digit, _mm_sub_epi8(c, _mm_set1_epi8('0'))),
+	    _mm_and_si128(alpha, _mm_sub_epi8(lc, _mm_set1_epi8('a' - 10))));
+
+	if (_mm_movemask_epi8(_mm_or_si128(digit, alpha)) != 0xffff)
+		*ok = 0;
+	return (v);
+}
+
+/*
+ * Pack each pair of nibbles (high first) into a byte; the result
+ * is in the low byte of each 16 bit lane.
+ */
+static inline __m128i
+ath3k_hex_pack(__m128i v)
+{
+
+	return (_mm_or_si128(
+	    _mm_slli_epi16(_mm_and_si128(v, _mm_set1_epi16(0x00ff)), 4),
+	    _mm_srli_epi16(v, 8)));
+}
+#endif
+
+/*
+ * As ath3k_hex_decode_scalar(), but 16 bytes at a time where the
+ * CPU allows.
+ */
+int
+ath3k_hex_decode(unsigned char *dst, const char *src, int len)
+{
+	int i = 0;
+#ifdef	__SSE2__
+	__m128i a, b;
+	int ok = 1;
+
+	for (; i + 16 <= len; i += 16) {
+		a = ath3k_hex_nibbles(
+		    _mm_loadu_si128((const __m128i *) (src + 2 * i)), &ok);
+		b = ath3k_hex_nibbles(
+		    _mm_loadu_si128((const __m128i *) (src + 2 * i + 16)), &ok);
+		if (! ok)
+			return (-1);
+		_mm_storeu_si128((__m128i *) (dst + i),
+		    _mm_packus_epi16(ath3k_hex_pack(a), ath3k_hex_pack(b)));
+	}
+#endif
+	return (ath3k_hex_decode_scalar(dst + i, src + 2 * i, len - i));
+}
+
+static void
+ath3k_rampatch_put32(unsigned char *p, uint32_t v)
+{
+
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+	p[2] = (v >> 16) & 0xff;
+	p[3] = (v >> 24) & 0xff;
+}
+
+/*
+ * Return the next line, with trailing white space trimmed; *next
+ * is pointed past it.
+ */
+static const char *
+ath3k_rampatch_line(const char *p, const char *end, int *len,
+    const char **next)
+{
+	const char *eol;
+
+	eol = memchr(p, '\n', end - p);
+	if (eol == NULL)
+		eol = end;
+	*next = (eol < end) ? eol + 1 : end;
+
+	while (eol > p && isspace((unsigned char) eol[-1]))
+		eol--;
+	*len = eol - p;
+	return (p);
+}
+
+static uint32_t
+ath3k_rampatch_get32(const unsigned char *p)
+{
+
+	return (p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24));
+}
+
+/*
+ * CRC-32 as used in the .dfu header: MSB first, polynomial
+ * 0x04c11db7, initial value and final XOR of 0xffffffff.
+ */
+uint32_t
+ath3k_rampatch_crc32(const unsigned char *buf, int len)
+{
+	uint32_t crc = 0xffffffff;
+	int i, j;
+
+	for (i = 0; i < len; i++) {
+		crc ^= (uint32_t) buf[i] << 24;
+		for (j = 0; j < 8; j++)
+			crc = (crc & 0x80000000) ?
+			    (crc << 1) ^ 0x04c11db7 : crc << 1;
+	}
+	return (crc ^ 0xffffffff);
+}
+
+/*
+ * Read a RamPatch.txt and decode it into a patch image, ready for
+ * ath3k_load_fwfile().
+ *
+ * The image is laid out as the shipped AthrBT_0x*.dfu patches are:
+ *
+ * + header: download address, the first word of the patch, payload
+ *   length, CRC-32 of the payload, 4 (32 bits each);
+ * + payload: 12 zero bytes, then the patch itself, which ends with
+ *   the ROM and build version (32 bits each).
+ *
+ * Everything is little endian.
+ *
+ * Returns 1 on success, 0 on error.
+ */
+int
+ath3k_rampatch_read(struct ath3k_firmware *fw, const char *fwname)
+{
+	struct ath3k_firmware src;
+	const char *p, *end, *line, *next;
+	unsigned long addr, plen;
+	unsigned char *buf, *patch;
+	int len;
+	char *ep;
+
+	if (ath3k_fw_read(&src, fwname) <= 0)
+		return (0);
+
+	p = (const char *) src.buf;
+	end = p + src.len;
+
+	/*
+	 * Download address.  The older (ROM 3.0) files don't carry
+	 * one, and there's no way of knowing where those go.
+	 */
+	line = ath3k_rampatch_line(p, end, &len, &next);
+	if (len <= 3 || strncmp(line, "DA:", 3) != 0) {
+		ath3k_err("%s: %s: no download address\n", __func__, fwname);
+		goto fail;
+	}
+	addr = strtoul(line + 3, &ep, 16);
+	if (ep != line + len || addr == 0) {
+		ath3k_err("%s: %s: bad download address\n", __func__, fwname);
+		goto fail;
+	}
+	p = next;
+
+	/* Length */
+	line = ath3k_rampatch_line(p, end, &len, &next);
+	plen = strtoul(line, &ep, 16);
+	if (len == 0 || ep != line + len || plen < 4) {
+		ath3k_err("%s: %s: bad length line\n", __func__, fwname);
+		goto fail;
+	}
+	p = next;
+
+	/* And the patch itself */
+	line = ath3k_rampatch_line(p, end, &len, &next);
+	if ((unsigned long) len != 2 * plen) {
+		ath3k_err("%s: %s: %d hex digits, expected %lu\n",
+		    __func__,
+		    fwname,
+		    len,
+		    2 * plen);
+		goto fail;
+	}
+
+	bzero(fw, sizeof(*fw));
+	if (ath3k_fw_alloc(fw, FW_HDR_SIZE + ATH3K_RAMPATCH_PAD + plen) == 0)
+		goto fail;
+	buf = fw->buf;
+	patch = buf + FW_HDR_SIZE + ATH3K_RAMPATCH_PAD;
+
+	if (ath3k_hex_decode(patch, line, plen) != 0) {
+		ath3k_err("%s: %s: bad hex digit\n", __func__, fwname);
+		ath3k_fw_free(fw);
+		goto fail;
+	}
+
+	/*
+	 * The newer files end with the version trailer and then a
+	 * single 0xff, which the .dfu patches don't have.  Only drop
+	 * it if what's in front of it really is a trailer, ie names
+	 * a ROM we know.
+	 */
+	if (plen >= 4 + 8 + 1 && patch[plen - 1] == 0xff &&
+	    ath3k_ps_load_addr(ath3k_rampatch_get32(patch + plen - 9)) != 0)
+		plen--;
+
+	ath3k_rampatch_put32(buf, addr);
+	ath3k_rampatch_put32(buf + 4, ath3k_rampatch_get32(patch));
+	ath3k_rampatch_put32(buf + 8, ATH3K_RAMPATCH_PAD + plen);
+	ath3k_rampatch_put32(buf + 12, ath3k_rampatch_crc32(
+	    buf + FW_HDR_SIZE, ATH3K_RAMPATCH_PAD + plen));
+	ath3k_rampatch_put32(buf + 16, 4);
+
+	ath3k_debug("%s: %s: address 0x%08lx, %lu bytes\n",
+	    __func__,
+	    fwname,
+	    addr,
+	    plen);
+
+	ath3k_fw_free(&src);
+	snprintf(fw->fwname, sizeof(fw->fwname), "%s", fwname);
+	fw->len = FW_HDR_SIZE + ATH3K_RAMPATCH_PAD + plen;
+	return (1);
+
+fail:
+	ath3k_fw_free(&src);
+	return (0);
+}
@@ -0,0 +1,55 @@
+/*-
+ * Copyright (c) 2013 Adrian Chadd <adrian@freebsd.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer,
+ *    without modification.
+ * 2. Redistributions in binary form must reproduce at minimum a disclaimer
+ *    similar to the "NO WARRANTY" disclaimer below ("Disclaimer") and any
+ *    redistribution must be conditioned upon including a substantially
+ *    similar Disclaimer requirement for further binary redistribution.
+ *
+ * NO WARRANTY
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF NONINFRINGEMENT, MERCHANTIBILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGES.
+ *
+ * $FreeBSD$
+ */
+#ifndef	__ATH3K_RAMPATCH_H__
+#define	__ATH3K_RAMPATCH_H__
+
+/*
+ * The ar3k/<rev>/RamPatch.txt files hold the RAM patch in hex:
+ *
+ * DA:00594000		<- download address
+ * 42f5			<- decoded length in bytes, hex
+ * 00589900...		<- the patch itself, two hex digits per byte
+ *
+ * The ROM 3.0 ones (30000, 30101) have no download address and
+ * can't be used.
+ */
+
+/* Zero bytes in front of the patch in the .dfu payload */
+#define	ATH3K_RAMPATCH_PAD		12
+
+extern	int ath3k_hex_decode(unsigned char *dst, const char *src, int len);
+extern	int ath3k_hex_decode_scalar(unsigned char *dst, const char *src,
+	    int len);
+extern	uint32_t ath3k_rampatch_crc32(const unsigned char *buf, int len);
+extern	int ath3k_rampatch_read(struct ath3k_firmware *fw,
+	    const char *fwname);
+
+#endif
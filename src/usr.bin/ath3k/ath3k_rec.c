@@ -0,0 +1,223 @@
+/*-
+ * Copyright (c) 2013 Adrian Chadd <adrian@freebsd.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer,
+ *    without modification.
+ * 2. Redistributions in binary form must reproduce at minimum a disclaimer
+ *    similar to the "NO WARRANTY" disclaimer below ("Disclaimer") and any
+ *    redistribution must be conditioned upon including a substantially
+ *    similar Disclaimer requirement for further binary redistribution.
+ *
+ * NO WARRANTY
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF NONINFRINGEMENT, MERCHANTIBILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGES.
+ *
+ * $FreeBSD$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <err.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ath3k_rec.h"
+#include "ath3k_dbg.h"
+#include "ath3k_time.h"
+
+struct ath3k_rec_hdr *ath3k_rec_hdr = NULL;
+static struct ath3k_rec_entry *ath3k_rec_ring = NULL;
+
+static const char *ath3k_rec_fmt[ATH3K_REC_MAX] = {
+	[ATH3K_REC_CTRL] = "ctrl: request 0x%02x, len %d, ret %d, %d us",
+	[ATH3K_REC_BULK_SUBMIT] = "bulk: submit offset %d, size %d, "
+	    "window %d",
+	[ATH3K_REC_BULK_DONE] = "bulk: done offset %d, size %d, "
+	    "status %d, %d us",
+	[ATH3K_REC_BULK_ROUND] = "bulk: round %d bytes/s, lat %d us, "
+	    "window %d",
+	[ATH3K_REC_FWFILE] = "fwfile: %d bytes",
+	[ATH3K_REC_DEADLINE] = "deadline: passed at offset %d",
+};
+
+#define	ATH3K_REC_SIZE(n)	(sizeof(struct ath3k_rec_hdr) +		\
+				    (n) * sizeof(struct ath3k_rec_entry))
+
+static void
+ath3k_rec_render(FILE *fp, uint64_t t, const struct ath3k_rec_entry *e)
+{
+
+	fprintf(fp, "%10llu.%06llu ",
+	    (unsigned long long) (t / 1000000),
+	    (unsigned long long) (t % 1000000));
+	if (e->type == 0 || e->type >= ATH3K_REC_MAX) {
+		fprintf(fp, "unknown event %d\n", e->type);
+		return;
+	}
+	/* Every format takes (up to) the four int args */
+	fprintf(fp, ath3k_rec_fmt[e->type],
+	    e->arg[0], e->arg[1], e->arg[2], e->arg[3]);
+	fprintf(fp, "\n");
+}
+
+void
+ath3k_rec_log(int type, int a0, int a1, int a2, int a3)
+{
+	struct ath3k_rec_entry *e, tmp;
+	uint64_t seq;
+
+	if (ath3k_rec_hdr == NULL) {
+		tmp.type = type;
+		tmp.arg[0] = a0;
+		tmp.arg[1] = a1;
+		tmp.arg[2] = a2;
+		tmp.arg[3] = a3;
+		ath3k_rec_render(stderr, ath3k_time_usec(), &tmp);
+		return;
+	}
+
+	/*
+	 * Mark the entry torn whilst it's being filled in, so a crash
+	 * half way through doesn't leave a plausible looking record.
+	 */
+	seq = ath3k_rec_hdr->head;
+	e = &ath3k_rec_ring[seq % ath3k_rec_hdr->nentries];
+	e->seq = 0;
+	__atomic_signal_fence(__ATOMIC_SEQ_CST);
+	e->t = ath3k_time_usec() - ath3k_rec_hdr->t0;
+	e->type = type;
+	e->arg[0] = a0;
+	e->arg[1] = a1;
+	e->arg[2] = a2;
+	e->arg[3] = a3;
+	__atomic_signal_fence(__ATOMIC_SEQ_CST);
+	e->seq = (uint32_t) seq + 1;
+	ath3k_rec_hdr->head = seq + 1;
+}
+
+/*
+ * Create (or reset) the recorder file and map it.
+ *
+ * Returns 1 if OK, 0 on error.
+ */
+int
+ath3k_rec_open(const char *file)
+{
+	size_t len = ATH3K_REC_SIZE(ATH3K_REC_NENTRIES);
+	void *p;
+	int fd;
+
+	fd = open(file, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		warn("%s: open: %s", __func__, file);
+		return (0);
+	}
+	if (ftruncate(fd, len) != 0) {
+		warn("%s: ftruncate: %s", __func__, file);
+		close(fd);
+		return (0);
+	}
+	p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		warn("%s: mmap: %s", __func__, file);
+		return (0);
+	}
+
+	ath3k_rec_hdr = p;
+	ath3k_rec_ring = (struct ath3k_rec_entry *) (ath3k_rec_hdr + 1);
+	ath3k_rec_hdr->version = ATH3K_REC_VERSION;
+	ath3k_rec_hdr->nentries = ATH3K_REC_NENTRIES;
+	ath3k_rec_hdr->head = 0;
+	ath3k_rec_hdr->t0 = ath3k_time_usec();
+	ath3k_rec_hdr->magic = ATH3K_REC_MAGIC;
+
+	return (1);
+}
+
+/*
+ * Render a recorder file to stdout, oldest record first.
+ *
+ * Returns 1 if OK, 0 on error.
+ */
+int
+ath3k_rec_dump(const char *file)
+{
+	const struct ath3k_rec_hdr *hdr;
+	const struct ath3k_rec_entry *ring, *e;
+	struct stat sb;
+	uint64_t seq, first;
+	void *p;
+	int fd, torn = 0;
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0) {
+		warn("%s: open: %s", __func__, file);
+		return (0);
+	}
+	if (fstat(fd, &sb) != 0) {
+		warn("%s: fstat: %s", __func__, file);
+		close(fd);
+		return (0);
+	}
+	if (sb.st_size < (off_t) sizeof(*hdr)) {
+		ath3k_err("%s: %s: too short\n", __func__, file);
+		close(fd);
+		return (0);
+	}
+	p = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		warn("%s: mmap: %s", __func__, file);
+		return (0);
+	}
+
+	hdr = p;
+	if (hdr->magic != ATH3K_REC_MAGIC ||
+	    hdr->version != ATH3K_REC_VERSION ||
+	    hdr->nentries == 0 ||
+	    (off_t) ATH3K_REC_SIZE(hdr->nentries) > sb.st_size) {
+		ath3k_err("%s: %s: not a recorder file\n", __func__, file);
+		munmap(p, sb.st_size);
+		return (0);
+	}
+	ring = (const struct ath3k_rec_entry *) (hdr + 1);
+
+	first = (hdr->head > hdr->nentries) ? hdr->head - hdr->nentries : 0;
+	for (seq = first; seq < hdr->head; seq++) {
+		e = &ring[seq % hdr->nentries];
+		if (e->seq != (uint32_t) seq + 1) {
+			torn++;
+			continue;
+		}
+		ath3k_rec_render(stdout, e->t, e);
+	}
+
+	if (torn != 0)
+		ath3k_err("%s: %d torn record(s) skipped\n", __func__, torn);
+	ath3k_info("%s: %llu records, %llu overwritten\n",
+	    __func__,
+	    (unsigned long long) (hdr->head - first),
+	    (unsigned long long) first);
+
+	munmap(p, sb.st_size);
+	return (1);
+}
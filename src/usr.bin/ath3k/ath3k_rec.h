@@ -0,0 +1,90 @@
+/*-
+ * Copyright (c) 2013 Adrian Chadd <adrian@freebsd.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer,
+ *    without modification.
+ * 2. Redistributions in binary form must reproduce at minimum a disclaimer
+ *    similar to the "NO WARRANTY" disclaimer below ("Disclaimer") and any
+ *    redistribution must be conditioned upon including a substantially
+ *    similar Disclaimer requirement for further binary redistribution.
+ *
+ * NO WARRANTY
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF NONINFRINGEMENT, MERCHANTIBILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGES.
+ *
+ * $FreeBSD$
+ */
+#ifndef	__ATH3K_REC_H__
+#define	__ATH3K_REC_H__
+
+/*
+ * Flight recorder.
+ *
+ * Hot path events (each control transfer, bulk chunk, etc) are
+ * written as fixed size binary records into a ring in a memory-mapped
+ * file, rather than formatted through stdio.  The file is MAP_SHARED,
+ * so whatever made it into the ring is still there if we crash.
+ * "ath3kfw -R file" renders it.
+ *
+ * It's always on: without -F the ring is /var/run/ath3kfw.<device>.rec.
+ * Only if that can't be made (eg not running as root) does -D render
+ * events straight to stderr, as ath3k_debug() would.
+ */
+
+#define	ATH3K_REC_MAGIC		0x41334b52	/* "A3KR" */
+#define	ATH3K_REC_VERSION	1
+#define	ATH3K_REC_NENTRIES	4096
+
+enum {
+	ATH3K_REC_CTRL = 1,	/* request, len, ret, usec */
+	ATH3K_REC_BULK_SUBMIT,	/* offset, size, window */
+	ATH3K_REC_BULK_DONE,	/* offset, size, status, usec */
+	ATH3K_REC_BULK_ROUND,	/* bytes/sec, mean latency, window */
+	ATH3K_REC_FWFILE,	/* length */
+	ATH3K_REC_DEADLINE,	/* offset */
+	ATH3K_REC_MAX
+};
+
+struct ath3k_rec_hdr {
+	uint32_t	magic;
+	uint32_t	version;
+	uint32_t	nentries;
+	uint32_t	pad;
+	uint64_t	head;		/* next sequence number */
+	uint64_t	t0;		/* ath3k_time_usec() at open */
+};
+
+struct ath3k_rec_entry {
+	uint64_t	t;		/* usec since t0 */
+	uint32_t	seq;		/* low bits of sequence + 1; 0 = torn */
+	uint16_t	type;
+	uint16_t	pad;
+	int32_t		arg[4];
+};
+
+extern	struct ath3k_rec_hdr *ath3k_rec_hdr;
+
+extern	void ath3k_rec_log(int type, int a0, int a1, int a2, int a3);
+extern	int ath3k_rec_open(const char *file);
+extern	int ath3k_rec_dump(const char *file);
+
+#define	ath3k_rec(type, a0, a1, a2, a3) do {				\
+	if (ath3k_rec_hdr != NULL || ath3k_do_debug)			\
+		ath3k_rec_log((type), (a0), (a1), (a2), (a3));		\
+} while (0)
+
+#endif
@@ -0,0 +1,226 @@
+/*-
+ * Copyright (c) 2013 Adrian Chadd <adrian@freebsd.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer,
+ *    without modification.
+ * 2. Redistributions in binary form must reproduce at minimum a disclaimer
+ *    similar to the "NO WARRANTY" disclaimer below ("Disclaimer") and any
+ *    redistribution must be conditioned upon including a substantially
+ *    similar Disclaimer requirement for further binary redistribution.
+ *
+ * NO WARRANTY
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF NONINFRINGEMENT, MERCHANTIBILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGES.
+ *
+ * $FreeBSD$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <err.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include <libusb.h>
+
+#include "ath3k_fw.h"
+#include "ath3k_hw.h"
+#include "ath3k_bdaddr.h"
+#include "ath3k_metrics.h"
+#include "ath3k_report.h"
+#include "ath3k_json.h"
+#include "ath3k_time.h"
+#include "ath3k_dbg.h"
+
+static struct {
+	int		fd;
+	const char	*name;
+	uint64_t	start;
+	time_t		when;
+	int		have_desc;
+	struct libusb_device_descriptor desc;
+	int		have_ver;
+	struct ath3k_version ver;
+	int		nfiles;
+	struct {
+		char	name[FILENAME_MAX];
+		int	len;
+	} files[ATH3K_REPORT_MAX_FILES];
+	int		nphases;
+	struct {
+		const char *name;
+		uint64_t usec;
+		int	ret;
+	} phases[ATH3K_REPORT_MAX_PHASES];
+} ath3k_report = { .fd = -1 };
+
+/*
+ * Returns 1 if OK, 0 on error.
+ */
+int
+ath3k_report_open(const char *file)
+{
+
+	ath3k_report.fd = open(file, O_WRONLY | O_CREAT | O_APPEND, 0644);
+	if (ath3k_report.fd < 0) {
+		warn("%s: open: %s", __func__, file);
+		return (0);
+	}
+	ath3k_report.start = ath3k_time_usec();
+	ath3k_report.when = time(NULL);
+	return (1);
+}
+
+void
+ath3k_report_device(const char *name, const struct libusb_device_descriptor *d)
+{
+
+	ath3k_report.name = name;
+	ath3k_report.desc = *d;
+	ath3k_report.have_desc = 1;
+}
+
+void
+ath3k_report_version(const struct ath3k_version *ver)
+{
+
+	ath3k_report.ver = *ver;
+	ath3k_report.have_ver = 1;
+}
+
+/*
+ * Note a firmware image that was sent to the device.
+ */
+void
+ath3k_report_file(const char *name, int len)
+{
+	int i = ath3k_report.nfiles;
+
+	if (ath3k_report.fd < 0 || i >= ATH3K_REPORT_MAX_FILES)
+		return;
+	snprintf(ath3k_report.files[i].name,
+	    sizeof(ath3k_report.files[i].name), "%s", name);
+	ath3k_report.files[i].len = len;
+	ath3k_report.nfiles++;
+}
+
+void
+ath3k_report_phase(const char *name, uint64_t usec, int ret)
+{
+	int i = ath3k_report.nphases;
+
+	if (ath3k_report.fd < 0 || i >= ATH3K_REPORT_MAX_PHASES)
+		return;
+	ath3k_report.phases[i].name = name;
+	ath3k_report.phases[i].usec = usec;
+	ath3k_report.phases[i].ret = ret;
+	ath3k_report.nphases++;
+}
+
+/*
+ * Write the record out and close the report.
+ *
+ * Returns 1 if OK (or there's no report), 0 on error.
+ */
+int
+ath3k_report_finish(const char *status)
+{
+	struct libusb_device_descriptor *d = &ath3k_report.desc;
+	struct ath3k_version *v = &ath3k_report.ver;
+	char *buf = NULL, ts[32];
+	size_t len = 0;
+	FILE *fp;
+	ssize_t r;
+	int i, ret = 1;
+
+	if (ath3k_report.fd < 0)
+		return (1);
+
+	fp = open_memstream(&buf, &len);
+	if (fp == NULL) {
+		warn("%s: open_memstream", __func__);
+		close(ath3k_report.fd);
+		ath3k_report.fd = -1;
+		return (0);
+	}
+
+	strftime(ts, sizeof(ts), "%Y-%m-%dT%H:%M:%SZ",
+	    gmtime(&ath3k_report.when));
+	fprintf(fp, "{\"time\":\"%s\",\"device\":", ts);
+	ath3k_json_str(fp, ath3k_report.name != NULL ?
+	    ath3k_report.name : "");
+	if (ath3k_report.have_desc)
+		fprintf(fp, ",\"vid\":\"%04x\",\"pid\":\"%04x\","
+		    "\"bcdDevice\":\"%04x\"",
+		    d->idVendor, d->idProduct, d->bcdDevice);
+	if (ath3k_report.have_ver)
+		fprintf(fp, ",\"rom_version\":%u,\"build_version\":%u,"
+		    "\"ram_version\":%u,\"ref_clock\":%u",
+		    (unsigned int) v->rom_version,
+		    (unsigned int) v->build_version,
+		    (unsigned int) v->ram_version,
+		    (unsigned int) v->ref_clock);
+	if (ath3k_bdaddr_valid)
+		fprintf(fp, ",\"bdaddr\":\"%02x:%02x:%02x:%02x:%02x:%02x\"",
+		    ath3k_bdaddr[0], ath3k_bdaddr[1], ath3k_bdaddr[2],
+		    ath3k_bdaddr[3], ath3k_bdaddr[4], ath3k_bdaddr[5]);
+
+	fprintf(fp, ",\"files\":[");
+	for (i = 0; i < ath3k_report.nfiles; i++) {
+		fprintf(fp, "%s{\"name\":", i == 0 ? "" : ",");
+		ath3k_json_str(fp, ath3k_report.files[i].name);
+		fprintf(fp, ",\"bytes\":%d}", ath3k_report.files[i].len);
+	}
+	fprintf(fp, "],\"bytes\":%llu",
+	    (unsigned long long) ath3k_counters[ATH3K_CTR_BULK_BYTES]);
+
+	fprintf(fp, ",\"phases\":[");
+	for (i = 0; i < ath3k_report.nphases; i++) {
+		fprintf(fp, "%s{\"name\":", i == 0 ? "" : ",");
+		ath3k_json_str(fp, ath3k_report.phases[i].name);
+		fprintf(fp, ",\"usec\":%llu,\"ret\":%d}",
+		    (unsigned long long) ath3k_report.phases[i].usec,
+		    ath3k_report.phases[i].ret);
+	}
+	fprintf(fp, "],\"timeouts\":%llu,\"backoffs\":%llu",
+	    (unsigned long long) ath3k_counters[ATH3K_CTR_TIMEOUTS],
+	    (unsigned long long) ath3k_counters[ATH3K_CTR_BULK_BACKOFFS]);
+	fprintf(fp, ",\"usec\":%llu,\"status\":",
+	    (unsigned long long) (ath3k_time_usec() - ath3k_report.start));
+	ath3k_json_str(fp, status);
+	fprintf(fp, "}\n");
+
+	if (fclose(fp) != 0 || buf == NULL) {
+		warn("%s: building the record", __func__);
+		ret = 0;
+	} else {
+		/* One write, so concurrent runs don't interleave */
+		r = write(ath3k_report.fd, buf, len);
+		if (r != (ssize_t) len) {
+			warn("%s: write", __func__);
+			ret = 0;
+		}
+	}
+
+	free(buf);
+	close(ath3k_report.fd);
+	ath3k_report.fd = -1;
+	return (ret);
+}
@@ -0,0 +1,224 @@
+/*-
+ * Copyright (c) 2013 Adrian Chadd <adrian@freebsd.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer,
+ *    without modification.
+ * 2. Redistributions in binary form must reproduce at minimum a disclaimer
+ *    similar to the "NO WARRANTY" disclaimer below ("Disclaimer") and any
+ *    redistribution must be conditioned upon including a substantially
+ *    similar Disclaimer requirement for further binary redistribution.
+ *
+ * NO WARRANTY
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF NONINFRINGEMENT, MERCHANTIBILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGES.
+ *
+ * $FreeBSD$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "ath3k_status.h"
+#include "ath3k_json.h"
+#include "ath3k_time.h"
+#include "ath3k_dbg.h"
+
+static struct {
+	int		fd;
+	const char	*path;
+	const char	*device;
+	const char	*phase;
+	const char	*file;
+	uint64_t	start;		/* run start */
+	uint64_t	file_start;
+	uint64_t	bytes;		/* this file */
+	uint64_t	total;		/* this file */
+	uint64_t	bytes_all;	/* every file so far */
+} ath3k_status = { .fd = -1 };
+
+/*
+ * Returns 1 if OK, 0 on error.
+ */
+int
+ath3k_status_open(const char *path)
+{
+	struct sockaddr_un sun;
+	struct stat sb;
+	int fd;
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(sun.sun_path)) {
+		ath3k_err("%s: %s: path too long\n", __func__, path);
+		return (0);
+	}
+	strcpy(sun.sun_path, path);
+
+	/* Only ever replace a stale socket, never some other file */
+	if (lstat(path, &sb) == 0) {
+		if (! S_ISSOCK(sb.st_mode)) {
+			ath3k_err("%s: %s: exists and isn't a socket\n",
+			    __func__,
+			    path);
+			return (0);
+		}
+		if (unlink(path) != 0) {
+			warn("%s: unlink: %s", __func__, path);
+			return (0);
+		}
+	} else if (errno != ENOENT) {
+		warn("%s: %s", __func__, path);
+		return (0);
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		warn("%s: socket", __func__);
+		return (0);
+	}
+	if (bind(fd, (struct sockaddr *) &sun, sizeof(sun)) != 0 ||
+	    listen(fd, 8) != 0 ||
+	    fcntl(fd, F_SETFL, O_NONBLOCK) != 0) {
+		warn("%s: %s", __func__, path);
+		close(fd);
+		return (0);
+	}
+
+	ath3k_status.fd = fd;
+	ath3k_status.path = path;
+	ath3k_status.start = ath3k_time_usec();
+	return (1);
+}
+
+void
+ath3k_status_close(void)
+{
+
+	if (ath3k_status.fd < 0)
+		return;
+	close(ath3k_status.fd);
+	(void) unlink(ath3k_status.path);
+	ath3k_status.fd = -1;
+}
+
+void
+ath3k_status_device(const char *name)
+{
+
+	ath3k_status.device = name;
+}
+
+void
+ath3k_status_phase(const char *name)
+{
+
+	ath3k_status.phase = name;
+	ath3k_status_poll();
+}
+
+void
+ath3k_status_file(const char *name, int total)
+{
+
+	ath3k_status.file = name;
+	ath3k_status.file_start = ath3k_time_usec();
+	ath3k_status.bytes = 0;
+	ath3k_status.total = total;
+}
+
+void
+ath3k_status_bytes(int bytes)
+{
+
+	ath3k_status.bytes += bytes;
+	ath3k_status.bytes_all += bytes;
+}
+
+static void
+ath3k_status_send(int fd)
+{
+	char *buf = NULL;
+	size_t len = 0;
+	uint64_t now, rate = 0, thru = 0, eta = 0, el;
+	FILE *fp;
+
+	now = ath3k_time_usec();
+	el = now - ath3k_status.file_start;
+	if (ath3k_status.file != NULL && el != 0)
+		rate = ath3k_status.bytes * 1000000ULL / el;
+	if (rate != 0 && ath3k_status.total > ath3k_status.bytes)
+		eta = (ath3k_status.total - ath3k_status.bytes) *
+		    1000000ULL / rate;
+	el = now - ath3k_status.start;
+	if (el != 0)
+		thru = ath3k_status.bytes_all * 1000000ULL / el;
+
+	fp = open_memstream(&buf, &len);
+	if (fp == NULL)
+		return;
+	fprintf(fp, "{\"device\":");
+	ath3k_json_str(fp, ath3k_status.device ? ath3k_status.device : "");
+	fprintf(fp, ",\"phase\":");
+	ath3k_json_str(fp, ath3k_status.phase ? ath3k_status.phase : "");
+	fprintf(fp, ",\"file\":");
+	ath3k_json_str(fp, ath3k_status.file ? ath3k_status.file : "");
+	fprintf(fp, ",\"bytes\":%llu,\"total\":%llu,\"rate\":%llu,"
+	    "\"eta_usec\":%llu,\"bytes_all\":%llu,\"throughput\":%llu,"
+	    "\"elapsed_usec\":%llu}\n",
+	    (unsigned long long) ath3k_status.bytes,
+	    (unsigned long long) ath3k_status.total,
+	    (unsigned long long) rate,
+	    (unsigned long long) eta,
+	    (unsigned long long) ath3k_status.bytes_all,
+	    (unsigned long long) thru,
+	    (unsigned long long) el);
+	if (fclose(fp) == 0 && buf != NULL) {
+		/* Best effort; a reader that can't keep up gets less */
+		(void) send(fd, buf, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+	}
+	free(buf);
+}
+
+/*
+ * Answer whoever is waiting on the socket, without blocking.
+ */
+void
+ath3k_status_poll(void)
+{
+	int fd;
+
+	if (ath3k_status.fd < 0)
+		return;
+
+	while ((fd = accept(ath3k_status.fd, NULL, NULL)) >= 0) {
+		ath3k_status_send(fd);
+		close(fd);
+	}
+	if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR &&
+	    errno != ECONNABORTED)
+		ath3k_debug("%s: accept: %s\n", __func__, strerror(errno));
+}
@@ -0,0 +1,57 @@
+/*-
+ * Copyright (c) 2013 Adrian Chadd <adrian@freebsd.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer,
+ *    without modification.
+ * 2. Redistributions in binary form must reproduce at minimum a disclaimer
+ *    similar to the "NO WARRANTY" disclaimer below ("Disclaimer") and any
+ *    redistribution must be conditioned upon including a substantially
+ *    similar Disclaimer requirement for further binary redistribution.
+ *
+ * NO WARRANTY
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF NONINFRINGEMENT, MERCHANTIBILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGES.
+ *
+ * $FreeBSD$
+ */
+#ifndef	__ATH3K_STATUS_H__
+#define	__ATH3K_STATUS_H__
+
+/*
+ * Live status socket (-U path).
+ *
+ * Each connection to the unix socket gets a one line JSON snapshot
+ * of where the load is - phase, file, bytes sent out of the file's
+ * total, the current and overall rate and an ETA for the file - and
+ * is then closed, eg:
+ *
+ *	nc -U /var/run/ath3kfw.sock
+ *
+ * The socket is non-blocking and only polled from the load loop,
+ * between transfers, so a slow or stuck reader never holds up the
+ * device.
+ */
+
+extern	int ath3k_status_open(const char *path);
+extern	void ath3k_status_close(void);
+extern	void ath3k_status_device(const char *name);
+extern	void ath3k_status_phase(const char *name);
+extern	void ath3k_status_file(const char *name, int total);
+extern	void ath3k_status_bytes(int bytes);
+extern	void ath3k_status_poll(void);
+
+#endif
@@ -0,0 +1,161 @@
+/*-
+ * Copyright (c) 2013 Adrian Chadd <adrian@freebsd.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer,
+ *    without modification.
+ * 2. Redistributions in binary form must reproduce at minimum a disclaimer
+ *    similar to the "NO WARRANTY" disclaimer below ("Disclaimer") and any
+ *    redistribution must be conditioned upon including a substantially
+ *    similar Disclaimer requirement for further binary redistribution.
+ *
+ * NO WARRANTY
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF NONINFRINGEMENT, MERCHANTIBILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGES.
+ *
+ * $FreeBSD$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <err.h>
+
+#include "ath3k_trace.h"
+#include "ath3k_json.h"
+#include "ath3k_time.h"
+#include "ath3k_dbg.h"
+
+FILE *ath3k_trace_fp = NULL;
+int ath3k_trace_chunks = 0;
+
+static int ath3k_trace_pid = 0;
+static int ath3k_trace_track = 0;
+static int ath3k_trace_nevents = 0;
+
+/*
+ * Start the next event; everything but the first needs a comma.
+ */
+static void
+ath3k_trace_event(const char *name, const char *ph, uint64_t ts)
+{
+
+	fprintf(ath3k_trace_fp, "%s{\"name\":",
+	    ath3k_trace_nevents++ == 0 ? "" : ",\n");
+	ath3k_json_str(ath3k_trace_fp, name);
+	fprintf(ath3k_trace_fp,
+	    ",\"cat\":\"ath3k\",\"ph\":\"%s\",\"ts\":%llu,"
+	    "\"pid\":%d,\"tid\":%d",
+	    ph,
+	    (unsigned long long) ts,
+	    ath3k_trace_pid,
+	    ath3k_trace_track);
+}
+
+/*
+ * Returns 1 if OK, 0 on error.
+ */
+int
+ath3k_trace_open(const char *file, int chunks)
+{
+
+	ath3k_trace_fp = fopen(file, "w");
+	if (ath3k_trace_fp == NULL) {
+		warn("%s: fopen: %s", __func__, file);
+		return (0);
+	}
+	ath3k_trace_pid = getpid();
+	ath3k_trace_chunks = chunks;
+	fprintf(ath3k_trace_fp, "[\n");
+	return (1);
+}
+
+void
+ath3k_trace_close(void)
+{
+
+	if (ath3k_trace_fp == NULL)
+		return;
+	fprintf(ath3k_trace_fp, "\n]\n");
+	if (fclose(ath3k_trace_fp) != 0)
+		warn("%s: fclose", __func__);
+	ath3k_trace_fp = NULL;
+}
+
+/*
+ * Put the following events on the given track (one per device),
+ * and name it.
+ */
+void
+ath3k_trace_set_track(int track, const char *name)
+{
+
+	if (ath3k_trace_fp == NULL)
+		return;
+	ath3k_trace_track = track;
+	ath3k_trace_event("thread_name", "M", 0);
+	fprintf(ath3k_trace_fp, ",\"args\":{\"name\":");
+	ath3k_json_str(ath3k_trace_fp, name);
+	fprintf(ath3k_trace_fp, "}}");
+}
+
+uint64_t
+ath3k_trace_start(void)
+{
+
+	if (ath3k_trace_fp == NULL)
+		return (0);
+	return (ath3k_time_usec());
+}
+
+/*
+ * Emit a span from start until now, with an optional "file" argument.
+ */
+void
+ath3k_trace_span(const char *name, uint64_t start, const char *arg)
+{
+	uint64_t now;
+
+	if (ath3k_trace_fp == NULL)
+		return;
+	now = ath3k_time_usec();
+	ath3k_trace_event(name, "X", start);
+	fprintf(ath3k_trace_fp, ",\"dur\":%llu",
+	    (unsigned long long) (now - start));
+	if (arg != NULL) {
+		fprintf(ath3k_trace_fp, ",\"args\":{\"file\":");
+		ath3k_json_str(ath3k_trace_fp, arg);
+		fprintf(ath3k_trace_fp, "}");
+	}
+	fprintf(ath3k_trace_fp, "}");
+}
+
+/*
+ * Per chunk instant events; only if asked for, as there are a lot.
+ */
+void
+ath3k_trace_instant(const char *name, int offset, int size)
+{
+
+	if (ath3k_trace_fp == NULL || ! ath3k_trace_chunks)
+		return;
+	ath3k_trace_event(name, "i", ath3k_time_usec());
+	fprintf(ath3k_trace_fp,
+	    ",\"s\":\"t\",\"args\":{\"offset\":%d,\"size\":%d}}",
+	    offset,
+	    size);
+}
@@ -0,0 +1,61 @@
+/*-
+ * Copyright (c) 2013 Adrian Chadd <adrian@freebsd.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer,
+ *    without modification.
+ * 2. Redistributions in binary form must reproduce at minimum a disclaimer
+ *    similar to the "NO WARRANTY" disclaimer below ("Disclaimer") and any
+ *    redistribution must be conditioned upon including a substantially
+ *    similar Disclaimer requirement for further binary redistribution.
+ *
+ * NO WARRANTY
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF NONINFRINGEMENT, MERCHANTIBILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGES.
+ *
+ * $FreeBSD$
+ */
+#ifndef	__ATH3K_TRACE_H__
+#define	__ATH3K_TRACE_H__
+
+/*
+ * Chrome / Perfetto trace-event JSON output.
+ *
+ * Each phase of the load is written as a complete ("X") event on the
+ * device's own track, so it can be loaded straight into
+ * chrome://tracing or ui.perfetto.dev.  The file uses the JSON array
+ * format, which viewers accept without the closing bracket, so a
+ * trace cut short by a crash still loads.
+ *
+ * Spans are timed with:
+ *
+ *	t = ath3k_trace_start();
+ *	...
+ *	ath3k_trace_span("name", t, NULL);
+ */
+
+extern	FILE *ath3k_trace_fp;
+extern	int ath3k_trace_chunks;
+
+extern	int ath3k_trace_open(const char *file, int chunks);
+extern	void ath3k_trace_close(void);
+extern	void ath3k_trace_set_track(int track, const char *name);
+extern	uint64_t ath3k_trace_start(void);
+extern	void ath3k_trace_span(const char *name, uint64_t start,
+	    const char *arg);
+extern	void ath3k_trace_instant(const char *name, int offset, int size);
+
+#endif
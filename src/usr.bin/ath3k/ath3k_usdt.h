@@ -0,0 +1,86 @@
+/*-
+ * Copyright (c) 2013 Adrian Chadd <adrian@freebsd.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer,
+ *    without modification.
+ * 2. Redistributions in binary form must reproduce at minimum a disclaimer
+ *    similar to the "NO WARRANTY" disclaimer below ("Disclaimer") and any
+ *    redistribution must be conditioned upon including a substantially
+ *    similar Disclaimer requirement for further binary redistribution.
+ *
+ * NO WARRANTY
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF NONINFRINGEMENT, MERCHANTIBILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGES.
+ *
+ * $FreeBSD$
+ */
+#ifndef	__ATH3K_USDT_H__
+#define	__ATH3K_USDT_H__
+
+/*
+ * USDT (user level statically defined tracing) probes, for attaching
+ * bpftrace / perf / SystemTap to a running ath3kfw, eg:
+ *
+ *	bpftrace -e 'usdt:/usr/sbin/ath3kfw:ath3k:bulk__done
+ *	    { @lat = hist(arg4); }'
+ *
+ * or dtrace -n 'ath3k$target:::bulk-done { @ = quantize(arg4); }' -p PID.
+ *
+ * Built with ATH3K_USDT (make WITH_USDT=yes) these are a single nop each
+ * until something attaches; otherwise they compile away entirely.  On
+ * FreeBSD they come from the ath3k_provider.d provider, run through
+ * dtrace -h / -G; elsewhere they are SystemTap's <sys/sdt.h> probes.
+ *
+ * The first argument of each is the device id, bus << 8 | address.
+ *
+ *	ctrl__start	dev, request, len
+ *	ctrl__done	dev, request, ret, usec
+ *	fwfile__start	dev, file name, len
+ *	fwfile__done	dev, file name, ret
+ *	bulk__submit	dev, offset, size
+ *	bulk__done	dev, offset, size, status, usec
+ *	phase__start	dev, phase name
+ *	phase__done	dev, phase name, ret
+ */
+
+#if defined(ATH3K_USDT) && defined(__FreeBSD__)
+#include "ath3k_provider.h"
+/*
+ * dtrace -h names each probe PROVIDER_PROBE, in upper case; the
+ * string arguments are declared char * in the provider.
+ */
+#define	ATH3K_USDT_ctrl__start(d, r, l)	ATH3K_CTRL_START(d, r, l)
+#define	ATH3K_USDT_ctrl__done(d, r, e, u)	ATH3K_CTRL_DONE(d, r, e, u)
+#define	ATH3K_USDT_fwfile__start(d, f, l)	\
+	ATH3K_FWFILE_START(d, (char *)(f), l)
+#define	ATH3K_USDT_fwfile__done(d, f, e)	\
+	ATH3K_FWFILE_DONE(d, (char *)(f), e)
+#define	ATH3K_USDT_bulk__submit(d, o, s)	ATH3K_BULK_SUBMIT(d, o, s)
+#define	ATH3K_USDT_bulk__done(d, o, s, st, u)	\
+	ATH3K_BULK_DONE(d, o, s, st, u)
+#define	ATH3K_USDT_phase__start(d, n)	ATH3K_PHASE_START(d, (char *)(n))
+#define	ATH3K_USDT_phase__done(d, n, e)	\
+	ATH3K_PHASE_DONE(d, (char *)(n), e)
+#define	ATH3K_USDT_PROBE(name, ...)	ATH3K_USDT_##name(__VA_ARGS__)
+#elif defined(ATH3K_USDT)
+#include <sys/sdt.h>
+#define	ATH3K_USDT_PROBE(name, ...)	STAP_PROBEV(ath3k, name, __VA_ARGS__)
+#else
+#define	ATH3K_USDT_PROBE(name, ...)	do { } while (0)
+#endif
+
+#endif
@@ -34,87 +34,176 @@
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
+#include <ctype.h>
 #include <err.h>
 #include <fcntl.h>
 #include <libgen.h>
+#include <paths.h>
+#include <dirent.h>
 #include <sys/stat.h>
 #include <sys/param.h>
+#include <sys/endian.h>
+#include <sysexits.h>
 
 #include <libusb.h>
 
 #include "ath3k_fw.h"
 #include "ath3k_hw.h"
+#include "ath3k_bw.h"
+#include "ath3k_hotplug.h"
+#include "ath3k_hci.h"
+#include "ath3k_ps.h"
+#include "ath3k_rampatch.h"
+#include "ath3k_bdaddr.h"
+#include "ath3k_devid.h"
+#include "ath3k_metrics.h"
+#include "ath3k_rec.h"
+#include "ath3k_trace.h"
+#include "ath3k_usdt.h"
+#include "ath3k_prof.h"
+#include "ath3k_report.h"
+#include "ath3k_status.h"
+#include "ath3k_arena.h"
+#include "ath3k_pin.h"
 #include "ath3k_dbg.h"
+#include "ath3k_time.h"
 
 #define	_DEFAULT_ATH3K_FIRMWARE_PATH	"/usr/share/firmware/ath3k/"
+#define	ATH3K_DEFAULT_WAIT_MS		5000
 
 int	ath3k_do_debug = 0;
 int	ath3k_do_info = 0;
+libusb_context *ath3k_ctx = NULL;
+int	ath3k_dev_id = 0;
 
-struct ath3k_devid {
-	uint16_t product_id;
-	uint16_t vendor_id;
-	int is_3012;
+static int
+ath3k_is_3012(struct libusb_device_descriptor *d)
+{
+
+	if (ath3k_devid_lookup(d->idVendor, d->idProduct) == 1) {
+		ath3k_debug("%s: found AR3012\n", __func__);
+		return (1);
+	}
+
+	/* Not found */
+	return (0);
+}
+
+/*
+ * AR3012 bring-up phases and their share of the overall deadline
+ * (-t).  Time a phase doesn't use rolls over into the later ones.
+ */
+enum {
+	ATH3K_PHASE_PATCH = 0,
+	ATH3K_PHASE_SYSCFG,
+	ATH3K_PHASE_NORMAL_MODE,
+	ATH3K_PHASE_SWITCH_PID,
+	ATH3K_PHASE_MAX
 };
 
-static struct ath3k_devid ath3k_list[] = {
-
-	/* Atheros AR3012 with sflash firmware*/
-	{ .vendor_id = 0x0489, .product_id = 0xe04e, .is_3012 = 1 },
-	{ .vendor_id = 0x0489, .product_id = 0xe04d, .is_3012 = 1 },
-	{ .vendor_id = 0x0489, .product_id = 0xe056, .is_3012 = 1 },
-	{ .vendor_id = 0x0489, .product_id = 0xe057, .is_3012 = 1 },
-	{ .vendor_id = 0x0489, .product_id = 0xe05f, .is_3012 = 1 },
-	{ .vendor_id = 0x04c5, .product_id = 0x1330, .is_3012 = 1 },
-	{ .vendor_id = 0x04ca, .product_id = 0x3004, .is_3012 = 1 },
-	{ .vendor_id = 0x04ca, .product_id = 0x3005, .is_3012 = 1 },
-	{ .vendor_id = 0x04ca, .product_id = 0x3006, .is_3012 = 1 },
-	{ .vendor_id = 0x04ca, .product_id = 0x3008, .is_3012 = 1 },
-	{ .vendor_id = 0x04ca, .product_id = 0x300b, .is_3012 = 1 },
-	{ .vendor_id = 0x0930, .product_id = 0x0219, .is_3012 = 1 },
-	{ .vendor_id = 0x0930, .product_id = 0x0220, .is_3012 = 1 },
-	{ .vendor_id = 0x0b05, .product_id = 0x17d0, .is_3012 = 1 },
-	{ .vendor_id = 0x0CF3, .product_id = 0x0036, .is_3012 = 1 },
-	{ .vendor_id = 0x0cf3, .product_id = 0x3004, .is_3012 = 1 },
-	{ .vendor_id = 0x0cf3, .product_id = 0x3005, .is_3012 = 1 },
-	{ .vendor_id = 0x0cf3, .product_id = 0x3008, .is_3012 = 1 },
-	{ .vendor_id = 0x0cf3, .product_id = 0x311D, .is_3012 = 1 },
-	{ .vendor_id = 0x0cf3, .product_id = 0x311E, .is_3012 = 1 },
-	{ .vendor_id = 0x0cf3, .product_id = 0x311F, .is_3012 = 1 },
-	{ .vendor_id = 0x0cf3, .product_id = 0x3121, .is_3012 = 1 },
-	{ .vendor_id = 0x0CF3, .product_id = 0x817a, .is_3012 = 1 },
-	{ .vendor_id = 0x0cf3, .product_id = 0xe004, .is_3012 = 1 },
-	{ .vendor_id = 0x0cf3, .product_id = 0xe005, .is_3012 = 1 },
-	{ .vendor_id = 0x0cf3, .product_id = 0xe006, .is_3012 = 1 },
-	{ .vendor_id = 0x0cf3, .product_id = 0xe003, .is_3012 = 1 },
-	{ .vendor_id = 0x13d3, .product_id = 0x3362, .is_3012 = 1 },
-	{ .vendor_id = 0x13d3, .product_id = 0x3375, .is_3012 = 1 },
-	{ .vendor_id = 0x13d3, .product_id = 0x3393, .is_3012 = 1 },
-	{ .vendor_id = 0x13d3, .product_id = 0x3402, .is_3012 = 1 },
-
-	/* Atheros AR5BBU22 with sflash firmware */
-	{ .vendor_id = 0x0489, .product_id = 0xE036, .is_3012 = 1 },
-	{ .vendor_id = 0x0489, .product_id = 0xE03C, .is_3012 = 1 },
+static const int ath3k_phase_weight[ATH3K_PHASE_MAX] = { 60, 25, 10, 5 };
+
+static uint64_t ath3k_budget_end = 0;
+
+/*
+ * Coex profiles there are syscfg variants for.
+ */
+static const char *ath3k_coex_profiles[] = {
+	"aclHighPri",
+	"aclLowPri",
 };
 
-static int
-ath3k_is_3012(struct libusb_device_descriptor *d)
+static void
+ath3k_phase_begin(int phase)
 {
+	uint64_t now, left;
+	int i, w = 0;
+
+	if (ath3k_budget_end == 0)
+		return;
+
+	now = ath3k_time_usec();
+	left = (now < ath3k_budget_end) ? ath3k_budget_end - now : 0;
+	for (i = phase; i < ATH3K_PHASE_MAX; i++)
+		w += ath3k_phase_weight[i];
+
+	ath3k_deadline_set(now + left * ath3k_phase_weight[phase] / w);
+	ath3k_debug("%s: phase %d: %llu us\n",
+	    __func__,
+	    phase,
+	    (unsigned long long) (left * ath3k_phase_weight[phase] / w));
+}
+
+/*
+ * Cold start timing: when each startup step up to the first GETSTATE
+ * finished, relative to the start of main().  Reported with -I.
+ */
+#define	ATH3K_STARTUP_MAX_STEPS		8
+
+static struct {
+	const char *name;
+	uint64_t t;
+} ath3k_startup_steps[ATH3K_STARTUP_MAX_STEPS];
+static int ath3k_startup_nsteps = 0;
+
+static void
+ath3k_startup_mark(const char *name)
+{
+
+	if (ath3k_startup_nsteps >= ATH3K_STARTUP_MAX_STEPS)
+		return;
+	ath3k_startup_steps[ath3k_startup_nsteps].name = name;
+	ath3k_startup_steps[ath3k_startup_nsteps].t = ath3k_time_usec();
+	ath3k_startup_nsteps++;
+}
+
+static void
+ath3k_startup_report(uint64_t t_start)
+{
+	uint64_t prev = t_start;
 	int i;
 
-	/* Search looking for whether it's an AR3012 */
-	for (i = 0; i < (int) nitems(ath3k_list); i++) {
-		if ((ath3k_list[i].product_id == d->idProduct) &&
-		    (ath3k_list[i].vendor_id == d->idVendor)) {
-			fprintf(stderr, "%s: found AR3012\n", __func__);
-			return (ath3k_list[i].is_3012);
-		}
+	for (i = 0; i < ath3k_startup_nsteps; i++) {
+		ath3k_info("startup: %-16s +%6llu us  (%7llu us)\n",
+		    ath3k_startup_steps[i].name,
+		    (unsigned long long) (ath3k_startup_steps[i].t - prev),
+		    (unsigned long long) (ath3k_startup_steps[i].t -
+		    t_start));
+		prev = ath3k_startup_steps[i].t;
 	}
+}
+
+/*
+ * Parse ugen name and extract device's bus and address
+ */
+
+static int
+parse_ugen_name(char const *ugen, uint8_t *bus, uint8_t *addr)
+{
+	char *ep;
+
+	if (strncmp(ugen, "ugen", 4) != 0)
+		return (-1);
+
+	*bus = (uint8_t) strtoul(ugen + 4, &ep, 10);
+	if (*ep != '.')
+		return (-1);
+
+	*addr = (uint8_t) strtoul(ep + 1, &ep, 10);
+	if (*ep != '\0')
+		return (-1);
 
-	/* Not found */
 	return (0);
 }
 
+static int
+ath3k_devname_is_ugen(char const *name)
+{
+	uint8_t bus, addr;
+
+	return (parse_ugen_name(name, &bus, &addr) == 0);
+}
+
 static libusb_device *
 ath3k_find_device(libusb_context *ctx, int bus_id, int dev_id)
 {
@@ -148,30 +237,188 @@ ath3k_find_device(libusb_context *ctx, int bus_id, int dev_id)
 	return (found);
 }
 
+/*
+ * Wrap an already open usbfs descriptor; libusb needn't go looking
+ * for the device at all.
+ */
+static libusb_device *
+ath3k_wrap_device(libusb_context *ctx, int fd, libusb_device_handle **hdl)
+{
+#if defined(LIBUSB_API_VERSION) && (LIBUSB_API_VERSION >= 0x01000107)
+	int r;
+
+	r = libusb_wrap_sys_device(ctx, (intptr_t) fd, hdl);
+	if (r != 0) {
+		ath3k_err("%s: libusb_wrap_sys_device() failed: code %d\n",
+		    __func__,
+		    r);
+		*hdl = NULL;
+		return (NULL);
+	}
+	return (libusb_ref_device(libusb_get_device(*hdl)));
+#else
+	ath3k_err("%s: libusb_wrap_sys_device() isn't available\n",
+	    __func__);
+	return (NULL);
+#endif
+}
+
+static int
+ath3k_sysfs_attr(const char *dir, const char *attr, unsigned int *val)
+{
+	char path[PATH_MAX];
+	FILE *fp;
+	int r;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, attr);
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		warn("%s: fopen: %s", __func__, path);
+		return (0);
+	}
+	r = fscanf(fp, "%u", val);
+	fclose(fp);
+	return (r == 1);
+}
+
+/*
+ * Open the device given with -d.  This is one of:
+ *
+ * + ugenX.Y - walk the device list looking for that bus/address;
+ * + /dev/bus/usb/BBB/DDD - open that usbfs node;
+ * + a sysfs device directory - open its usbfs node, found via
+ *   its busnum/devnum attributes;
+ * + fd:N - an already open usbfs descriptor, eg handed over by udev.
+ *
+ * The ugen case leaves *hdl as NULL for the caller to open; the rest
+ * never enumerate the bus and return the device already open.
+ * *sys_fd is set to the descriptor opened here (and so to be closed
+ * once the handle is), or -1.
+ */
+static libusb_device *
+ath3k_open_device(libusb_context *ctx, const char *name,
+    libusb_device_handle **hdl, int *sys_fd)
+{
+	libusb_device *dev;
+	char node[PATH_MAX];
+	unsigned int bus, addr;
+	uint8_t bus_id, dev_id;
+	char *ep;
+	int fd;
+
+	*hdl = NULL;
+	*sys_fd = -1;
+
+	if (parse_ugen_name(name, &bus_id, &dev_id) == 0)
+		return (ath3k_find_device(ctx, bus_id, dev_id));
+
+	if (strncmp(name, "fd:", 3) == 0) {
+		fd = strtol(name + 3, &ep, 10);
+		if (*ep != '\0' || fd < 0) {
+			ath3k_err("%s: bad descriptor: %s\n", __func__, name);
+			return (NULL);
+		}
+		return (ath3k_wrap_device(ctx, fd, hdl));
+	}
+
+	if (strncmp(name, "/sys/", 5) == 0) {
+		if (! ath3k_sysfs_attr(name, "busnum", &bus) ||
+		    ! ath3k_sysfs_attr(name, "devnum", &addr))
+			return (NULL);
+		snprintf(node, sizeof(node), "/dev/bus/usb/%03u/%03u",
+		    bus, addr);
+		name = node;
+	}
+
+	fd = open(name, O_RDWR | O_CLOEXEC);
+	if (fd < 0) {
+		warn("%s: open: %s", __func__, name);
+		return (NULL);
+	}
+
+	dev = ath3k_wrap_device(ctx, fd, hdl);
+	if (dev == NULL) {
+		close(fd);
+		return (NULL);
+	}
+	*sys_fd = fd;
+	return (dev);
+}
+
+/*
+ * Bookkeeping around each step of ath3k_init_ar3012() and
+ * ath3k_init_firmware(): profiling, status, USDT probes, metrics, the
+ * trace and the run report.  op is the metrics histogram, or -1.
+ */
+static uint64_t
+ath3k_step_start(const char *name, const char *prof)
+{
+
+	ath3k_prof_begin(prof);
+	ath3k_status_phase(name);
+	ATH3K_USDT_PROBE(phase__start, ath3k_dev_id, name);
+	return (ath3k_time_usec());
+}
+
+static void
+ath3k_step_done(const char *name, int op, uint64_t t, int ret)
+{
+	uint64_t usec;
+
+	usec = ath3k_time_usec() - t;
+	ATH3K_USDT_PROBE(phase__done, ath3k_dev_id, name, ret);
+	if (op >= 0)
+		ath3k_hist_add(op, usec);
+	ath3k_trace_span(name, t, NULL);
+	ath3k_report_phase(name, usec, ret);
+}
+
+/* The re-enumeration watch, if there is one */
+static struct ath3k_hotplug *ath3k_wait_hp = NULL;
+
 static int
 ath3k_init_ar3012(libusb_device_handle *hdl, const char *fw_path)
 {
+	uint64_t t;
 	int ret;
 
+	ath3k_phase_begin(ATH3K_PHASE_PATCH);
+	t = ath3k_step_start("load_patch", "patch usb");
 	ret = ath3k_load_patch(hdl, fw_path);
+	ath3k_step_done("load_patch", ATH3K_OP_LOAD_PATCH, t, ret);
 	if (ret < 0) {
 		ath3k_err("Loading patch file failed\n");
 	return (ret);
 	}
 
+	ath3k_phase_begin(ATH3K_PHASE_SYSCFG);
+	t = ath3k_step_start("load_syscfg", "syscfg usb");
 	ret = ath3k_load_syscfg(hdl, fw_path);
+	ath3k_step_done("load_syscfg", ATH3K_OP_LOAD_SYSCFG, t, ret);
 	if (ret < 0) {
 		ath3k_err("Loading sysconfig file failed\n");
 		return (ret);
 	}
 
+	ath3k_phase_begin(ATH3K_PHASE_NORMAL_MODE);
+	t = ath3k_step_start("set_normal_mode", "normal mode");
 	ret = ath3k_set_normal_mode(hdl);
+	ath3k_step_done("set_normal_mode", ATH3K_OP_SET_NORMAL_MODE, t, ret);
 	if (ret < 0) {
 		ath3k_err("Set normal mode failed\n");
 		return (ret);
 	}
 
-	ath3k_switch_pid(hdl);
+	/*
+	 * The device may well drop off the bus before acking this, so
+	 * its result doesn't count.
+	 */
+	ath3k_phase_begin(ATH3K_PHASE_SWITCH_PID);
+	t = ath3k_step_start("switch_pid", "switch pid");
+	if (ath3k_wait_hp != NULL)
+		ath3k_hotplug_start(ath3k_wait_hp);
+	ret = ath3k_switch_pid(hdl);
+	ath3k_step_done("switch_pid", ATH3K_OP_SWITCH_PID, t, ret);
 	return (0);
 }
 
@@ -180,6 +427,7 @@ ath3k_init_firmware(libusb_device_handle *hdl, const char *file_prefix)
 {
 	struct ath3k_firmware fw;
 	char fwname[FILENAME_MAX];
+	uint64_t t;
 	int ret;
 
 	/* XXX path info? */
@@ -188,56 +436,250 @@ ath3k_init_firmware(libusb_device_handle *hdl, const char *file_prefix)
 	ath3k_debug("%s: loading ath3k-1.fw\n", __func__);
 
 	/* Read in the firmware */
-	if (ath3k_fw_read(&fw, fwname) <= 0) {
+	ath3k_prof_begin("firmware read");
+	t = ath3k_trace_start();
+	ret = ath3k_fw_read(&fw, fwname);
+	ath3k_trace_span("fw_read", t, fwname);
+	if (ret <= 0) {
 		fprintf(stderr, "%s: ath3k_fw_read() failed\n",
 		    __func__);
 		return (-1);
 	}
 
 	/* Load in the firmware */
+	t = ath3k_step_start("load_firmware", "firmware usb");
 	ret = ath3k_load_fwfile(hdl, &fw);
+	ath3k_step_done("load_firmware", -1, t, ret);
+
+	/* The device switches to it once it has the lot */
+	if (ret >= 0 && ath3k_wait_hp != NULL)
+		ath3k_hotplug_start(ath3k_wait_hp);
 
 	/* free it */
 	ath3k_fw_free(&fw);
 
-	return (0);
+	return (ret);
 }
 
 /*
- * Parse ugen name and extract device's bus and address
+ * Parse a byte count with an optional k/m suffix.
  */
-
 static int
-parse_ugen_name(char const *ugen, uint8_t *bus, uint8_t *addr)
+parse_size(char const *str, uint64_t *val)
 {
 	char *ep;
 
-	if (strncmp(ugen, "ugen", 4) != 0)
+	*val = strtoull(str, &ep, 10);
+	switch (*ep) {
+	case 'k':
+	case 'K':
+		*val *= 1024;
+		ep++;
+		break;
+	case 'm':
+	case 'M':
+		*val *= 1024 * 1024;
+		ep++;
+		break;
+	}
+	if (ep == str || *ep != '\0')
 		return (-1);
 
-	*bus = (uint8_t) strtoul(ugen + 4, &ep, 10);
-	if (*ep != '.')
-		return (-1);
+	return (0);
+}
 
-	*addr = (uint8_t) strtoul(ep + 1, &ep, 10);
-	if (*ep != '\0')
-		return (-1);
+/*
+ * Name the default flight recorder file for a device, eg
+ * /var/run/ath3kfw.ugen1.2.rec; anything but [A-Za-z0-9.] in the
+ * device name becomes '_'.
+ */
+static void
+ath3k_rec_default_name(char *buf, size_t len, const char *dev_name)
+{
+	char *p;
 
-	return (0);
+	snprintf(buf, len, "%sath3kfw.%s.rec", _PATH_VARRUN, dev_name);
+	for (p = buf + strlen(_PATH_VARRUN); *p != '\0'; p++) {
+		if (! isalnum((unsigned char) *p) && *p != '.')
+			*p = '_';
+	}
+}
+
+/*
+ * Is there any syscfg variant for the given coex profile under
+ * fw_path?  None ship by default (see FWGEN_COEX in the Makefile),
+ * so this lets -x fail up front rather than after the patch load.
+ */
+static int
+ath3k_coex_installed(const char *fw_path, const char *profile)
+{
+	char path[PATH_MAX], suffix[64];
+	struct dirent *de;
+	DIR *dir;
+	size_t n, len;
+	int found = 0;
+
+	snprintf(path, sizeof(path), "%s/ar3k", fw_path);
+	snprintf(suffix, sizeof(suffix), "_%s.dfu", profile);
+	len = strlen(suffix);
+
+	dir = opendir(path);
+	if (dir == NULL)
+		return (0);
+	while (!found && (de = readdir(dir)) != NULL) {
+		n = strlen(de->d_name);
+		found = strncmp(de->d_name, "ramps_", 6) == 0 && n > len &&
+		    strcmp(de->d_name + n - len, suffix) == 0;
+	}
+	closedir(dir);
+
+	return (found);
 }
 
 static void
 usage(void)
 {
 	fprintf(stderr,
-	    "Usage: ath3kfw (-D) -d ugenX.Y (-f firmware path) (-I)\n");
+	    "Usage: ath3kfw (-D) -d device (-f firmware path) (-I) "
+	    "(-b rate) (-B burst)\n"
+	    "    (-t msec) (-w msec) (-P) (-s file.pst) (-r RamPatch.txt)\n"
+	    "    (-a statefile | -A bdaddr) (-T tag[@off]=hex ...) "
+	    "(-x coex profile)\n"
+	    "    (-L devid file) (-M metrics file) (-F recorder file)\n"
+	    "    (-j trace file (-J)) (-S) (-O report file) "
+	    "(-U status socket)\n"
+	    "    (-C cache dir)\n");
+	fprintf(stderr,
+	    "       ath3kfw (-I) -c rom_version (-s file.pst | "
+	    "-r RamPatch.txt) -o output\n");
+	fprintf(stderr,
+	    "       ath3kfw (-I) -R recorder file\n");
+	fprintf(stderr,
+	    "       ath3kfw (-D) (-I) (-f firmware path) -K cap\n");
+	fprintf(stderr, "    -a: allocate the BD_ADDR from this state file\n");
+	fprintf(stderr, "    -A: set the BD_ADDR (xx:xx:xx:xx:xx:xx)\n");
+	fprintf(stderr, "    -b: limit bulk download bandwidth, bytes/sec\n");
+	fprintf(stderr, "    -B: bandwidth limit burst size, bytes\n");
+	fprintf(stderr, "    -C: cache compiled .pst images here (default "
+	    ATH3K_PS_CACHE_DIR ")\n");
+	fprintf(stderr, "    -c: compile an image for this ROM version, "
+	    "offline\n");
 	fprintf(stderr, "    -D: enable debugging\n");
-	fprintf(stderr, "    -d: device to operate upon\n");
+	fprintf(stderr, "    -d: device to operate upon: ugenX.Y, "
+	    "/dev/bus/usb/BBB/DDD,\n"
+	    "        a /sys/bus/usb/devices path or fd:N\n");
+	fprintf(stderr, "    -F: record events to this flight recorder file "
+	    "(default\n"
+	    "        " _PATH_VARRUN "ath3kfw.<device>.rec, when writable)\n");
 	fprintf(stderr, "    -f: firmware path, if not default\n");
 	fprintf(stderr, "    -I: enable informational output\n");
+	fprintf(stderr, "    -j: write a Chrome/Perfetto trace to this file\n");
+	fprintf(stderr, "    -J: include per chunk events in the trace\n");
+	fprintf(stderr, "    -K: keep up to this many KB of the most recently "
+	    "used\n"
+	    "        firmware images locked in memory, until killed\n");
+	fprintf(stderr, "    -L: load extra AR3012 device IDs from a file\n");
+	fprintf(stderr, "    -M: add to the Prometheus metrics in this file\n");
+	fprintf(stderr, "    -O: append a JSON run report to this file\n");
+	fprintf(stderr, "    -o: output file for -c\n");
+	fprintf(stderr, "    -P: probe the HCI once the device is back\n");
+	fprintf(stderr, "    -R: render a flight recorder file\n");
+	fprintf(stderr, "    -r: decode and load this RamPatch.txt as the "
+	    "patch\n");
+	fprintf(stderr, "    -S: print the host CPU cost of each phase\n");
+	fprintf(stderr, "    -s: compile and load this .pst as the syscfg\n");
+	fprintf(stderr, "    -t: give up on the device after this many msec\n");
+	fprintf(stderr, "    -T: override syscfg tag bytes; &= and |= clear "
+	    "and set bits\n");
+	fprintf(stderr, "    -U: serve load progress on this unix socket\n");
+	fprintf(stderr, "    -w: wait this many msec for the device to "
+	    "re-enumerate\n");
+	fprintf(stderr, "    -x: coex profile: aclHighPri or aclLowPri\n");
 	exit(127);
 }
 
+/*
+ * Build a firmware image from its source form (-s or -r) for the
+ * given ROM version, without touching any device.
+ */
+static int
+ath3k_compile(uint32_t rom_version, const char *outname)
+{
+	struct ath3k_firmware fw;
+	uint32_t tmp;
+	int ret;
+
+	if (ath3k_syscfg_pst != NULL)
+		ret = ath3k_ps_load(&fw, ath3k_syscfg_pst, rom_version);
+	else
+		ret = ath3k_rampatch_read(&fw, ath3k_patch_txt);
+	if (ret <= 0)
+		return (1);
+
+	/* A patch says which ROM it's for in its trailer */
+	if (ath3k_patch_txt != NULL) {
+		memcpy(&tmp, fw.buf + fw.len - 8, sizeof(tmp));
+		if (le32toh(tmp) != rom_version) {
+			ath3k_err("%s: %s is for ROM 0x%08x, not 0x%08x\n",
+			    __func__,
+			    ath3k_patch_txt,
+			    le32toh(tmp),
+			    rom_version);
+			ath3k_fw_free(&fw);
+			return (1);
+		}
+	}
+
+	ret = ath3k_fw_write(&fw, outname);
+	ath3k_info("%s: %s: %d bytes\n", __func__, outname, fw.len);
+	ath3k_fw_free(&fw);
+
+	return (ret ? 0 : 1);
+}
+
+/*
+ * Confirm the firmware is really running by talking HCI to it,
+ * and report how long it took from startup until it was usable.
+ *
+ * Returns 1 if the device checks out, 0 otherwise.
+ */
+static int
+ath3k_probe(libusb_device *dev, uint64_t t_start)
+{
+	struct ath3k_hci_version hv;
+
+	if (ath3k_hci_probe(dev, &hv) == 0) {
+		ath3k_err("%s: HCI probe failed\n", __func__);
+		return (0);
+	}
+
+	ath3k_info("%s: HCI version %d rev 0x%04x, LMP version %d "
+	    "subversion 0x%04x, manufacturer %d; usable after %llu ms\n",
+	    __func__,
+	    hv.hci_ver,
+	    hv.hci_rev,
+	    hv.lmp_ver,
+	    hv.lmp_subver,
+	    hv.manufacturer,
+	    (unsigned long long) ((ath3k_time_usec() - t_start) / 1000));
+
+	/*
+	 * XXX this assumes the patch build version shows up in the
+	 * LMP subversion.  Until that's confirmed a mismatch is only
+	 * worth a warning; it mustn't fail a good device.
+	 */
+	if (ath3k_patch_build_version != 0 &&
+	    hv.lmp_subver != (ath3k_patch_build_version & 0xffff)) {
+		ath3k_err("%s: warning: LMP subversion 0x%04x doesn't match "
+		    "the loaded patch build 0x%04x\n",
+		    __func__,
+		    hv.lmp_subver,
+		    ath3k_patch_build_version & 0xffff);
+	}
+
+	return (1);
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -248,43 +690,148 @@ main(int argc, char *argv[])
 	unsigned char state;
 	struct ath3k_version ver;
 	int r;
-	uint8_t bus_id = 0, dev_id = 0;
-	int devid_set = 0;
-	int n;
-	char *firmware_path = NULL;
+	const char *dev_name = NULL;
+	int sys_fd = -1;
+	int n, i;
+	const char *firmware_path = _DEFAULT_ATH3K_FIRMWARE_PATH;
 	int is_3012 = 0;
+	uint64_t bw_rate = 0, bw_burst = 0;
+	unsigned long budget_ms = 0;
+	unsigned long wait_ms = 0;
+	struct ath3k_hotplug hp;
+	int do_probe = 0;
+	int do_profile = 0;
+	int exit_code = 0;
+	const char *result = NULL;
+	uint64_t t_start;
+	uint32_t compile_rom = 0;
+	char *compile_out = NULL;
+	const char *metrics_file = NULL;
+	const char *trace_file = NULL;
+	const char *report_file = NULL;
+	const char *status_path = NULL;
+	int trace_chunks = 0;
+	const char *rec_file = NULL;
+	const char *rec_dump = NULL;
+	char rec_default[PATH_MAX];
+	unsigned long pin_kb = 0;
+	char track[64];
+	uint64_t t;
+	char *ep;
 
-	/* libusb setup */
-	r = libusb_init(&ctx);
-	if (r != 0) {
-		ath3k_err("%s: libusb_init failed: code %d\n",
-		    argv[0],
-		    r);
-		exit(127);
-	}
-
-	/* Enable debugging, just because */
-	libusb_set_debug(ctx, 3);
+	t_start = ath3k_time_usec();
 
 	/* Parse command line arguments */
-	while ((n = getopt(argc, argv, "Dd:f:hIm:p:v:")) != -1) {
+	while ((n = getopt(argc, argv,
+	    "a:A:b:B:C:c:Dd:F:f:hIj:JK:L:M:m:O:o:Pp:R:r:Ss:T:t:U:v:w:x:"))
+	    != -1) {
 		switch (n) {
-		case 'd': /* ugen device name */
-			devid_set = 1;
-			if (parse_ugen_name(optarg, &bus_id, &dev_id) < 0)
+		case 'a': /* BD_ADDR allocator state */
+			ath3k_bdaddr_state = optarg;
+			break;
+		case 'A': /* fixed BD_ADDR */
+			if (ath3k_bdaddr_parse(optarg, ath3k_bdaddr) !=
+			    (int) strlen(optarg))
 				usage();
+			ath3k_bdaddr_valid = 1;
+			break;
+		case 'b': /* bandwidth limit */
+			if (parse_size(optarg, &bw_rate) < 0)
+				usage();
+			break;
+		case 'B': /* bandwidth limit burst */
+			if (parse_size(optarg, &bw_burst) < 0)
+				usage();
+			break;
+		case 'C': /* compiled .pst cache */
+			ath3k_ps_cache_dir = optarg;
+			break;
+		case 'c': /* offline compile */
+			compile_rom = strtoul(optarg, &ep, 16);
+			if (*ep != '\0' || compile_rom == 0)
+				usage();
+			break;
+		case 'd': /* device: ugen name, usbfs/sysfs path or fd */
+			dev_name = optarg;
 			break;
 		case 'D':
 			ath3k_do_debug = 1;
 			break;
+		case 'F': /* flight recorder */
+			rec_file = optarg;
+			break;
 		case 'f': /* firmware path */
-			if (firmware_path)
-				free(firmware_path);
-			firmware_path = strdup(optarg);
+			firmware_path = optarg;
 			break;
 		case 'I':
 			ath3k_do_info = 1;
 			break;
+		case 'j': /* trace-event JSON */
+			trace_file = optarg;
+			break;
+		case 'J': /* ... with per chunk events */
+			trace_chunks = 1;
+			break;
+		case 'K': /* pin firmware images */
+			pin_kb = strtoul(optarg, &ep, 10);
+			if (*ep != '\0' || pin_kb == 0)
+				usage();
+			break;
+		case 'L': /* extra device IDs */
+			if (! ath3k_devid_load(optarg))
+				exit(1);
+			break;
+		case 'M': /* metrics output */
+			metrics_file = optarg;
+			break;
+		case 'O': /* JSON run report */
+			report_file = optarg;
+			break;
+		case 'o': /* offline compile output */
+			compile_out = optarg;
+			break;
+		case 'P': /* HCI readiness probe */
+			do_probe = 1;
+			break;
+		case 'R': /* render a flight recorder file */
+			rec_dump = optarg;
+			break;
+		case 'r': /* patch from RamPatch.txt source */
+			ath3k_patch_txt = optarg;
+			break;
+		case 'S': /* self-profile */
+			do_profile = 1;
+			break;
+		case 's': /* syscfg from .pst source */
+			ath3k_syscfg_pst = optarg;
+			break;
+		case 't': /* overall deadline */
+			budget_ms = strtoul(optarg, &ep, 10);
+			if (*ep != '\0' || budget_ms == 0)
+				usage();
+			break;
+		case 'T': /* syscfg tag override */
+			if (ath3k_ps_override_add(optarg) < 0)
+				usage();
+			break;
+		case 'U': /* status socket */
+			status_path = optarg;
+			break;
+		case 'w': /* wait for re-enumeration */
+			wait_ms = strtoul(optarg, &ep, 10);
+			if (*ep != '\0' || wait_ms == 0)
+				usage();
+			break;
+		case 'x': /* coex profile */
+			for (i = 0; i < (int) nitems(ath3k_coex_profiles);
+			    i++) {
+				if (strcmp(optarg, ath3k_coex_profiles[i]) == 0)
+					ath3k_coex_profile =
+					    ath3k_coex_profiles[i];
+			}
+			if (ath3k_coex_profile == NULL)
+				usage();
+			break;
 		case 'h':
 		default:
 			usage();
@@ -293,24 +840,133 @@ main(int argc, char *argv[])
 		}
 	}
 
+	/* Render a flight recorder file; likewise */
+	if (rec_dump != NULL)
+		exit(ath3k_rec_dump(rec_dump) ? 0 : 1);
+
+	/* Hold the firmware images resident; likewise */
+	if (pin_kb != 0)
+		exit(ath3k_pin_run(firmware_path, pin_kb * 1024) ? 0 : 1);
+
+	/* -x picks a pre-built syscfg, which -s replaces */
+	if (ath3k_coex_profile != NULL && ath3k_syscfg_pst != NULL) {
+		ath3k_err("%s: -x can't be used with -s; give the "
+		    "profile's .pst to -s instead\n",
+		    basename(argv[0]));
+		exit(127);
+	}
+	if (ath3k_coex_profile != NULL && compile_rom == 0 &&
+	    !ath3k_coex_installed(firmware_path, ath3k_coex_profile)) {
+		ath3k_err("%s: -x %s: no coex syscfg variants are installed "
+		    "under %s/ar3k; none are built by default (see "
+		    "FWGEN_COEX)\n",
+		    basename(argv[0]),
+		    ath3k_coex_profile,
+		    firmware_path);
+		exit(127);
+	}
+
+	/* Offline compile; no device needed */
+	if (compile_rom != 0) {
+		if (compile_out == NULL ||
+		    (ath3k_syscfg_pst == NULL) == (ath3k_patch_txt == NULL))
+			usage();
+		r = ath3k_compile(compile_rom, compile_out);
+		exit(r);
+	}
+
+	/* The probe needs the re-enumerated device */
+	if (do_probe && wait_ms == 0)
+		wait_ms = ATH3K_DEFAULT_WAIT_MS;
+
 	/* Ensure the devid was given! */
-	if (devid_set == 0) {
+	if (dev_name == NULL) {
 		usage();
 		/* NOTREACHED */
 	}
+	ath3k_startup_mark("args");
+
+	/*
+	 * Only create (and truncate) the output files once the
+	 * arguments are known to be good.
+	 */
+	if (rec_file != NULL && ! ath3k_rec_open(rec_file))
+		exit(1);
+	/*
+	 * The recorder is always on; without -F it goes to a ring per
+	 * device under /var/run, if we're allowed to write there.
+	 * Failing that is only worth a debug message.
+	 */
+	if (rec_file == NULL) {
+		ath3k_rec_default_name(rec_default, sizeof(rec_default),
+		    dev_name);
+		if (access(_PATH_VARRUN, W_OK) == 0 &&
+		    ath3k_rec_open(rec_default)) {
+			ath3k_debug("%s: recording to %s\n",
+			    basename(argv[0]),
+			    rec_default);
+		} else {
+			ath3k_debug("%s: can't record to %s\n",
+			    basename(argv[0]),
+			    rec_default);
+		}
+	}
+	if (trace_file != NULL && ! ath3k_trace_open(trace_file, trace_chunks))
+		exit(1);
+	if (do_profile && ! ath3k_prof_init())
+		exit(1);
+	if (report_file != NULL && ! ath3k_report_open(report_file))
+		exit(1);
+	if (status_path != NULL && ! ath3k_status_open(status_path))
+		exit(1);
+
+#if defined(LIBUSB_API_VERSION) && (LIBUSB_API_VERSION >= 0x01000108)
+	/*
+	 * If we've been handed the device node there's no need for
+	 * libusb to scan the bus at init time.  Waiting for the device
+	 * to come back needs hotplug, which does.
+	 */
+	if (! ath3k_devname_is_ugen(dev_name) && wait_ms == 0)
+		(void) libusb_set_option(NULL,
+		    LIBUSB_OPTION_NO_DEVICE_DISCOVERY);
+#endif
+
+	/* libusb setup */
+	r = libusb_init(&ctx);
+	if (r != 0) {
+		ath3k_err("%s: libusb_init failed: code %d\n",
+		    argv[0],
+		    r);
+		exit(127);
+	}
+	ath3k_ctx = ctx;
 
-	ath3k_debug("%s: opening dev %d.%d\n",
+	/* libusb debugging is slow to set up; only do it if asked */
+	if (ath3k_do_debug)
+		libusb_set_debug(ctx, 3);
+	ath3k_startup_mark("libusb_init");
+
+	ath3k_bw_init(bw_rate, bw_burst);
+
+	/* Start the clock on the overall deadline */
+	if (budget_ms != 0) {
+		ath3k_budget_end = ath3k_time_usec() + budget_ms * 1000ULL;
+		ath3k_deadline_set(ath3k_budget_end);
+	}
+
+	ath3k_debug("%s: opening dev %s\n",
 	    basename(argv[0]),
-	    (int) bus_id,
-	    (int) dev_id);
+	    dev_name);
 
-	/* Find a device based on the bus/dev id */
-	dev = ath3k_find_device(ctx, bus_id, dev_id);
+	/* Find (and possibly open) the device */
+	t = ath3k_trace_start();
+	dev = ath3k_open_device(ctx, dev_name, &hdl, &sys_fd);
 	if (dev == NULL) {
 		ath3k_err("%s: device not found\n", __func__);
-		/* XXX cleanup? */
-		exit(1);
+		exit_code = 1;
+		goto done;
 	}
+	ath3k_startup_mark("find_device");
 
 	/* Get the device descriptor for this device entry */
 	r = libusb_get_device_descriptor(dev, &d);
@@ -318,7 +974,22 @@ main(int argc, char *argv[])
 		warn("%s: libusb_get_device_descriptor: %s\n",
 		    __func__,
 		    libusb_strerror(r));
-		exit(1);
+		exit_code = 1;
+		goto done;
+	}
+	ath3k_startup_mark("get_descriptor");
+
+	ath3k_dev_id = (libusb_get_bus_number(dev) << 8) |
+	    libusb_get_device_address(dev);
+	ath3k_report_device(dev_name, &d);
+	ath3k_status_device(dev_name);
+
+	/* One trace track per device */
+	if (ath3k_trace_fp != NULL) {
+		snprintf(track, sizeof(track), "%s %04x:%04x",
+		    dev_name, d.idVendor, d.idProduct);
+		ath3k_trace_set_track(ath3k_dev_id, track);
+		ath3k_trace_span("enumerate", t, NULL);
 	}
 
 	/* See if its an AR3012 */
@@ -330,7 +1001,8 @@ main(int argc, char *argv[])
 			ath3k_debug("%s: AR3012; bcdDevice=%d, exiting\n",
 			    __func__,
 			    d.bcdDevice);
-			exit(0);
+			result = "skipped";
+			goto done;
 		}
 	}
 
@@ -338,13 +1010,45 @@ main(int argc, char *argv[])
 
 	/* XXX enforce the device/product id if they're non-zero */
 
-	/* Grab device handle */
-	r = libusb_open(dev, &hdl);
+	/* Grab device handle, if it's not already open */
+	if (hdl == NULL)
+		r = libusb_open(dev, &hdl);
 	if (r != 0) {
 		ath3k_err("%s: libusb_open() failed: code %d\n", __func__, r);
-		/* XXX cleanup? */
-		exit(1);
+		exit_code = 1;
+		goto done;
+	}
+	ath3k_startup_mark("open");
+
+	/*
+	 * If asked, watch for the device coming back once the firmware
+	 * is running; this has to be set up before it's loaded.  If it
+	 * can't be, the -w / -P check that was asked for can't be made,
+	 * so don't go ahead and report success without it.
+	 */
+	if (wait_ms != 0) {
+		if (ath3k_hotplug_arm(ctx, &hp, dev, &d) != 0) {
+			ath3k_err("%s: can't watch for the device to "
+			    "re-enumerate; not loading\n",
+			    basename(argv[0]));
+			exit_code = 1;
+			goto done;
+		}
+		ath3k_wait_hp = &hp;
+	}
+
+	/*
+	 * Allocate everything the load needs now.  Finding the device
+	 * (which on ugen walks libusb's device list), opening it and
+	 * arming hotplug all allocate, so they're done first; past here
+	 * the image buffers come out of the arena and the control and
+	 * bulk transfers are reused.
+	 */
+	if (! ath3k_arena_init(ATH3K_ARENA_SIZE) || ! ath3k_hw_init()) {
+		exit_code = 127;
+		goto done;
 	}
+	ath3k_startup_mark("prealloc");
 
 	/*
 	 * Get the initial NIC state.
@@ -352,9 +1056,11 @@ main(int argc, char *argv[])
 	r = ath3k_get_state(hdl, &state);
 	if (r == 0) {
 		ath3k_err("%s: ath3k_get_state() failed!\n", __func__);
-		/* XXX cleanup? */
-		exit(1);
+		exit_code = 1;
+		goto done;
 	}
+	ath3k_startup_mark("get_state");
+	ath3k_startup_report(t_start);
 	ath3k_debug("%s: state=0x%02x\n",
 	    __func__,
 	    (int) state);
@@ -363,8 +1069,8 @@ main(int argc, char *argv[])
 	r = ath3k_get_version(hdl, &ver);
 	if (r == 0) {
 		ath3k_err("%s: ath3k_get_version() failed!\n", __func__);
-		/* XXX cleanup? */
-		exit(1);
+		exit_code = 1;
+		goto done;
 	}
 	ath3k_info("ROM version: %d, build version: %d, ram version: %d, "
 	    "ref clock=%d\n",
@@ -372,15 +1078,43 @@ main(int argc, char *argv[])
 	    ver.build_version,
 	    ver.ram_version,
 	    ver.ref_clock);
-
-	/* Default the firmware path */
-	if (firmware_path == NULL)
-		firmware_path = strdup(_DEFAULT_ATH3K_FIRMWARE_PATH);
+	ath3k_report_version(&ver);
 
 	if (is_3012) {
-		(void) ath3k_init_ar3012(hdl, firmware_path);
+		r = ath3k_init_ar3012(hdl, firmware_path);
 	} else {
-		(void) ath3k_init_firmware(hdl, firmware_path);
+		r = ath3k_init_firmware(hdl, firmware_path);
+	}
+	ath3k_prof_report();
+	ath3k_info("%s: arena: %zu of %zu bytes at peak, "
+	    "%llu heap allocations\n",
+	    basename(argv[0]),
+	    ath3k_arena.high,
+	    ath3k_arena.size,
+	    (unsigned long long) ath3k_counters[ATH3K_CTR_HEAP_ALLOCS]);
+
+	/*
+	 * If we ran out of time, tell the caller to try again later
+	 * rather than letting one sick device hold things up.
+	 */
+	if (ath3k_deadline_missed()) {
+		ath3k_err("%s: deadline of %lu ms exceeded\n",
+		    basename(argv[0]),
+		    budget_ms);
+		if (wait_ms != 0)
+			ath3k_hotplug_disarm(ctx, &hp);
+		exit_code = EX_TEMPFAIL;
+		result = "deadline";
+		goto done;
+	}
+
+	/* No point waiting for a device we didn't manage to load */
+	if (r < 0) {
+		exit_code = 1;
+		if (wait_ms != 0) {
+			ath3k_hotplug_disarm(ctx, &hp);
+			wait_ms = 0;
+		}
 	}
 
 	/* Shutdown */
@@ -390,6 +1124,60 @@ main(int argc, char *argv[])
 	libusb_unref_device(dev);
 	dev = NULL;
 
+	if (sys_fd >= 0)
+		close(sys_fd);
+	sys_fd = -1;
+
+	/* Wait for the device to re-enumerate */
+	if (wait_ms != 0) {
+		if (ath3k_hotplug_wait(ctx, &hp, wait_ms)) {
+			ath3k_info("%s: re-enumerated as %04x:%04x "
+			    "bcdDevice=0x%04x after %llu ms\n",
+			    basename(argv[0]),
+			    hp.desc.idVendor,
+			    hp.desc.idProduct,
+			    hp.desc.bcdDevice,
+			    (unsigned long long) (hp.latency / 1000));
+			ath3k_report_phase("reenumerate", hp.latency, 0);
+			if (do_probe && ath3k_probe(hp.dev, t_start) == 0)
+				exit_code = 1;
+		} else {
+			ath3k_err("%s: device didn't re-enumerate within "
+			    "%lu ms\n",
+			    basename(argv[0]),
+			    wait_ms);
+			exit_code = 1;
+		}
+		ath3k_hotplug_disarm(ctx, &hp);
+	}
+
+	/*
+	 * Every run that got as far as opening libusb ends up here,
+	 * so the metrics, trace, report and status socket are always
+	 * finished off; failures come in still holding the device.
+	 */
+done:
+	if (ath3k_wait_hp != NULL)
+		ath3k_hotplug_disarm(ctx, ath3k_wait_hp);
+	if (hdl != NULL)
+		libusb_close(hdl);
+	if (dev != NULL)
+		libusb_unref_device(dev);
+	if (sys_fd >= 0)
+		close(sys_fd);
+	ath3k_hw_fini();
 	libusb_exit(ctx);
 	ctx = NULL;
+
+	if (result == NULL)
+		result = (exit_code == 0) ? "ok" : "failed";
+	if (metrics_file != NULL && ! ath3k_metrics_write(metrics_file) &&
+	    exit_code == 0)
+		exit_code = 1;
+	ath3k_trace_close();
+	if (! ath3k_report_finish(result) && exit_code == 0)
+		exit_code = 1;
+	ath3k_status_close();
+
+	exit(exit_code);
 }
@@ -0,0 +1,242 @@
+/*-
+ * Copyright (c) 2013 Adrian Chadd <adrian@freebsd.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer,
+ *    without modification.
+ * 2. Redistributions in binary form must reproduce at minimum a disclaimer
+ *    similar to the "NO WARRANTY" disclaimer below ("Disclaimer") and any
+ *    redistribution must be conditioned upon including a substantially
+ *    similar Disclaimer requirement for further binary redistribution.
+ *
+ * NO WARRANTY
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF NONINFRINGEMENT, MERCHANTIBILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGES.
+ *
+ * $FreeBSD$
+ */
+
+/*
+ * Time reading and building the images a load sends, the way the
+ * flash path does after startup:
+ *
+ * + ath3k-1.fw and the stock AthrBT / ramps .dfu files, via
+ *   ath3k_fw_read();
+ * + RamPatch.txt via ath3k_rampatch_read() and PS_ASIC.pst via
+ *   ath3k_ps_load(), as -r and -s do.
+ *
+ * flash_bench [-n iterations]
+ *
+ * Once the arena is set up nothing should come from the heap.  The
+ * test is linked with malloc(), calloc(), realloc() and strdup()
+ * wrapped (see the Makefile), and fails on any call to them after
+ * ath3k_arena_init(), as well as if a buffer isn't from the arena or
+ * one is left live at the end of a pass.
+ *
+ * The files are looked for in $ATH3K_FWDIR, or the installed
+ * firmware directory; ones that aren't there (the .pst and
+ * RamPatch.txt sources aren't installed) are skipped.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <err.h>
+
+#include "ath3k_fw.h"
+#include "ath3k_arena.h"
+#include "ath3k_ps.h"
+#include "ath3k_rampatch.h"
+#include "ath3k_time.h"
+
+int ath3k_do_debug = 0;
+int ath3k_do_info = 0;
+
+static const char ath3k_test_fwdir[] = "/usr/share/firmware/ath3k";
+
+#define	BENCH_ROM		0x01020200
+
+enum { IMG_FW, IMG_RAMPATCH, IMG_PS };
+
+static const struct {
+	int		type;
+	const char	*name;
+} images[] = {
+	{ IMG_FW,	"ath3k-1.fw" },
+	{ IMG_FW,	"ar3k/AthrBT_0x01020200.dfu" },
+	{ IMG_FW,	"ar3k/ramps_0x01020200_26.dfu" },
+	{ IMG_RAMPATCH,	"ar3k/1020200/RamPatch.txt" },
+	{ IMG_PS,	"ar3k/1020200/PS_ASIC.pst" },
+};
+
+static int nfail = 0;
+
+#define	CHECK(cond, ...) do {						\
+	if (! (cond)) {							\
+		warnx(__VA_ARGS__);					\
+		nfail++;						\
+	}								\
+} while (0)
+
+/*
+ * The allocator, wrapped at link time.  Only calls from the code
+ * linked into the test are seen, which is the point: libc's own
+ * internal use (eg stdio buffers) isn't the flash path's doing.
+ */
+extern	void *__real_malloc(size_t len);
+extern	void *__real_calloc(size_t n, size_t len);
+extern	void *__real_realloc(void *p, size_t len);
+extern	char *__real_strdup(const char *s);
+
+static int counting = 0;
+static unsigned long nallocs = 0;
+
+void *
+__wrap_malloc(size_t len)
+{
+
+	nallocs += counting;
+	return (__real_malloc(len));
+}
+
+void *
+__wrap_calloc(size_t n, size_t len)
+{
+
+	nallocs += counting;
+	return (__real_calloc(n, len));
+}
+
+void *
+__wrap_realloc(void *p, size_t len)
+{
+
+	nallocs += counting;
+	return (__real_realloc(p, len));
+}
+
+char *
+__wrap_strdup(const char *s)
+{
+
+	nallocs += counting;
+	return (__real_strdup(s));
+}
+
+static int
+load(int type, struct ath3k_firmware *fw, const char *name)
+{
+
+	switch (type) {
+	case IMG_RAMPATCH:
+		return (ath3k_rampatch_read(fw, name));
+	case IMG_PS:
+		return (ath3k_ps_load(fw, name, BENCH_ROM));
+	default:
+		return (ath3k_fw_read(fw, name) > 0);
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct ath3k_firmware fw;
+	char name[nitems(images)][FILENAME_MAX];
+	const char *fwdir;
+	uint64_t t, best[nitems(images)];
+	int ch, i, j, found = 0, iters = 100;
+
+	while ((ch = getopt(argc, argv, "n:")) != -1) {
+		switch (ch) {
+		case 'n':
+			iters = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: flash_bench [-n iterations]\n");
+			exit(1);
+		}
+	}
+	if (iters <= 0)
+		errx(1, "bad iterations");
+
+	fwdir = getenv("ATH3K_FWDIR");
+	if (fwdir == NULL)
+		fwdir = ath3k_test_fwdir;
+	ath3k_ps_cache_dir = NULL;
+
+	for (j = 0; j < (int) nitems(images); j++) {
+		snprintf(name[j], sizeof(name[j]), "%s/%s", fwdir,
+		    images[j].name);
+		best[j] = UINT64_MAX;
+		if (access(name[j], R_OK) != 0) {
+			printf("%s: not found; skipped\n", name[j]);
+			name[j][0] = '\0';
+			continue;
+		}
+		found++;
+	}
+	if (found == 0) {
+		printf("nothing under %s; skipped\n", fwdir);
+		return (0);
+	}
+
+	if (! ath3k_arena_init(ATH3K_ARENA_SIZE))
+		errx(1, "arena setup failed");
+	counting = 1;
+
+	for (i = 0; i < iters; i++) {
+		for (j = 0; j < (int) nitems(images); j++) {
+			if (name[j][0] == '\0')
+				continue;
+			t = ath3k_time_usec();
+			if (! load(images[j].type, &fw, name[j])) {
+				CHECK(0, "%s: load failed", name[j]);
+				continue;
+			}
+			t = ath3k_time_usec() - t;
+			if (t < best[j])
+				best[j] = t;
+			CHECK(ath3k_arena_owns(fw.buf),
+			    "%s: not from the arena", name[j]);
+			ath3k_fw_free(&fw);
+		}
+		CHECK(ath3k_arena.live == 0,
+		    "pass %d: %d buffers left live", i, ath3k_arena.live);
+	}
+
+	counting = 0;
+	CHECK(nallocs == 0, "%lu heap allocations after setup", nallocs);
+
+	printf("best of %d; arena %zu of %zu bytes at peak, "
+	    "%lu heap allocations\n",
+	    iters,
+	    ath3k_arena.high,
+	    ath3k_arena.size,
+	    nallocs);
+	for (j = 0; j < (int) nitems(images); j++) {
+		if (name[j][0] != '\0')
+			printf("%-32s %8llu us\n", images[j].name,
+			    (unsigned long long) best[j]);
+	}
+
+	if (nfail != 0) {
+		printf("%d checks failed\n", nfail);
+		return (1);
+	}
+	return (0);
+}
@@ -0,0 +1,147 @@
+/*-
+ * Copyright (c) 2013 Adrian Chadd <adrian@freebsd.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer,
+ *    without modification.
+ * 2. Redistributions in binary form must reproduce at minimum a disclaimer
+ *    similar to the "NO WARRANTY" disclaimer below ("Disclaimer") and any
+ *    redistribution must be conditioned upon including a substantially
+ *    similar Disclaimer requirement for further binary redistribution.
+ *
+ * NO WARRANTY
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF NONINFRINGEMENT, MERCHANTIBILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGES.
+ *
+ * $FreeBSD$
+ */
+
+/*
+ * Time the RamPatch.txt hex decoders against each other:
+ *
+ * + naive: sscanf() a byte at a time, as a straightforward decoder
+ *   would;
+ * + scalar: ath3k_hex_decode_scalar();
+ * + vector: ath3k_hex_decode(), SSE2 where built for it.
+ *
+ * hexdecode_bench [-n iterations] [-s bytes]
+ *
+ * The outputs are compared, so this also fails if they disagree.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <err.h>
+
+#include "ath3k_fw.h"
+#include "ath3k_rampatch.h"
+#include "ath3k_time.h"
+
+int ath3k_do_debug = 0;
+int ath3k_do_info = 0;
+
+static int
+naive_decode(unsigned char *dst, const char *src, int len)
+{
+	unsigned int v;
+	char b[3];
+	int i;
+
+	b[2] = '\0';
+	for (i = 0; i < len; i++) {
+		b[0] = src[2 * i];
+		b[1] = src[2 * i + 1];
+		if (sscanf(b, "%2x", &v) != 1)
+			return (-1);
+		dst[i] = v;
+	}
+	return (0);
+}
+
+static uint64_t
+run(int (*fn)(unsigned char *, const char *, int), unsigned char *dst,
+    const char *src, int len, int iters)
+{
+	uint64_t t, best = UINT64_MAX;
+	int i;
+
+	for (i = 0; i < iters; i++) {
+		t = ath3k_time_usec();
+		if (fn(dst, src, len) != 0)
+			errx(1, "decode failed");
+		t = ath3k_time_usec() - t;
+		if (t < best)
+			best = t;
+	}
+	return (best == 0 ? 1 : best);
+}
+
+int
+main(int argc, char *argv[])
+{
+	static const char hex[] = "0123456789abcdefABCDEF";
+	unsigned char *d0, *d1, *d2;
+	uint64_t t0, t1, t2;
+	char *src;
+	int ch, i, len = 1024 * 1024, iters = 5;
+
+	while ((ch = getopt(argc, argv, "n:s:")) != -1) {
+		switch (ch) {
+		case 'n':
+			iters = atoi(optarg);
+			break;
+		case 's':
+			len = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: hexdecode_bench "
+			    "[-n iterations] [-s bytes]\n");
+			exit(1);
+		}
+	}
+	if (iters <= 0 || len <= 0)
+		errx(1, "bad iterations or size");
+
+	src = malloc(2 * len);
+	d0 = malloc(len);
+	d1 = malloc(len);
+	d2 = malloc(len);
+	if (src == NULL || d0 == NULL || d1 == NULL || d2 == NULL)
+		err(1, "malloc");
+
+	srandom(1);
+	for (i = 0; i < 2 * len; i++)
+		src[i] = hex[random() % (sizeof(hex) - 1)];
+
+	t0 = run(naive_decode, d0, src, len, iters);
+	t1 = run(ath3k_hex_decode_scalar, d1, src, len, iters);
+	t2 = run(ath3k_hex_decode, d2, src, len, iters);
+
+	if (memcmp(d0, d1, len) != 0 || memcmp(d0, d2, len) != 0)
+		errx(1, "decoders disagree");
+
+	printf("%d bytes, best of %d\n", len, iters);
+	printf("naive   %8llu us %8.1f MB/s\n", (unsigned long long) t0,
+	    (double) len / t0);
+	printf("scalar  %8llu us %8.1f MB/s  %5.1fx\n",
+	    (unsigned long long) t1, (double) len / t1, (double) t0 / t1);
+	printf("vector  %8llu us %8.1f MB/s  %5.1fx\n",
+	    (unsigned long long) t2, (double) len / t2, (double) t0 / t2);
+	return (0);
+}
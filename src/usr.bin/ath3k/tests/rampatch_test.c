@@ -0,0 +1,341 @@
+/*-
+ * Copyright (c) 2013 Adrian Chadd <adrian@freebsd.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer,
+ *    without modification.
+ * 2. Redistributions in binary form must reproduce at minimum a disclaimer
+ *    similar to the "NO WARRANTY" disclaimer below ("Disclaimer") and any
+ *    redistribution must be conditioned upon including a substantially
+ *    similar Disclaimer requirement for further binary redistribution.
+ *
+ * NO WARRANTY
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF NONINFRINGEMENT, MERCHANTIBILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGES.
+ *
+ * $FreeBSD$
+ */
+
+/*
+ * Checks for the RamPatch.txt decoder:
+ *
+ * + ath3k_hex_decode() (SSE2 where built for it) gives the same
+ *   answers as ath3k_hex_decode_scalar(), on good and bad input;
+ * + a RamPatch.txt made from each shipped AthrBT_0x*.dfu decodes
+ *   back into exactly that .dfu;
+ * + files without a download address are refused, and a trailing
+ *   0xff that isn't after a version trailer is kept;
+ * + a .pst compiled through the cache comes back the same from it,
+ *   and a damaged cache file is recompiled over.
+ *
+ * The shipped images are looked for in $ATH3K_FWDIR, or the
+ * installed firmware directory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <err.h>
+
+#include "ath3k_fw.h"
+#include "ath3k_ps.h"
+#include "ath3k_rampatch.h"
+
+int ath3k_do_debug = 0;
+int ath3k_do_info = 0;
+
+static const char ath3k_test_fwdir[] = "/usr/share/firmware/ath3k";
+
+static const uint32_t ath3k_test_roms[] = {
+	0x01020001, 0x01020200, 0x01020201, 0x11020000, 0x31010000
+};
+
+static int nfail = 0;
+
+#define	CHECK(cond, ...) do {						\
+	if (! (cond)) {							\
+		warnx(__VA_ARGS__);					\
+		nfail++;						\
+	}								\
+} while (0)
+
+static const char ath3k_test_hex[] = "0123456789abcdefABCDEF";
+
+static void
+test_decode_equiv(void)
+{
+	static char src[2 * 4096];
+	static unsigned char d1[4096], d2[4096];
+	static const char bad[] = "gG/:@`~ \n\x80\xff";
+	int len, i, j, r1, r2, iter;
+
+	/* Good input, every length and alignment of the tail */
+	for (iter = 0; iter < 2000; iter++) {
+		len = (iter < 300) ? iter : random() % 4096;
+		for (i = 0; i < 2 * len; i++)
+			src[i] = ath3k_test_hex[random() %
+			    (sizeof(ath3k_test_hex) - 1)];
+		memset(d1, 0x5a, sizeof(d1));
+		memset(d2, 0xa5, sizeof(d2));
+		r1 = ath3k_hex_decode_scalar(d1, src, len);
+		r2 = ath3k_hex_decode(d2, src, len);
+		CHECK(r1 == 0 && r2 == 0, "len %d: returned %d/%d",
+		    len, r1, r2);
+		CHECK(memcmp(d1, d2, len) == 0, "len %d: output differs",
+		    len);
+	}
+
+	/* Every byte value in every position of a 64 byte input */
+	for (i = 0; i < 2 * 64; i++) {
+		for (j = 0; j < 256; j++) {
+			memset(src, '7', 2 * 64);
+			src[i] = j;
+			r1 = ath3k_hex_decode_scalar(d1, src, 64);
+			r2 = ath3k_hex_decode(d2, src, 64);
+			CHECK(r1 == r2, "byte 0x%02x at %d: returned %d/%d",
+			    j, i, r1, r2);
+			if (r1 == 0 && r2 == 0)
+				CHECK(memcmp(d1, d2, 64) == 0,
+				    "byte 0x%02x at %d: output differs", j, i);
+		}
+	}
+	for (i = 0; bad[i] != '\0'; i++) {
+		memset(src, 'f', 2 * 64);
+		src[2 * 64 - 1] = bad[i];
+		CHECK(ath3k_hex_decode(d2, src, 64) == -1,
+		    "0x%02x not rejected", (unsigned char) bad[i]);
+	}
+}
+
+static int
+write_file(const char *name, const char *buf, size_t len)
+{
+	FILE *fp;
+	int ok;
+
+	fp = fopen(name, "w");
+	if (fp == NULL)
+		err(1, "%s", name);
+	ok = (fwrite(buf, 1, len, fp) == len);
+	return (fclose(fp) == 0 && ok);
+}
+
+static uint32_t
+get32(const unsigned char *p)
+{
+
+	return (p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24));
+}
+
+/*
+ * Turn a shipped .dfu back into the RamPatch.txt it would have come
+ * from, and check that decoding gives the .dfu again.
+ */
+static void
+test_roundtrip(const char *fwdir, const char *tmpname)
+{
+	struct ath3k_firmware dfu, fw;
+	char name[FILENAME_MAX], *txt;
+	size_t n, plen;
+	unsigned int i, k;
+	int found = 0;
+
+	for (k = 0; k < sizeof(ath3k_test_roms) / sizeof(ath3k_test_roms[0]);
+	    k++) {
+		snprintf(name, sizeof(name), "%s/ar3k/AthrBT_0x%08x.dfu",
+		    fwdir, ath3k_test_roms[k]);
+		if (access(name, R_OK) != 0)
+			continue;
+		if (ath3k_fw_read(&dfu, name) <= 0) {
+			CHECK(0, "%s: can't read", name);
+			continue;
+		}
+		found++;
+
+		CHECK(get32(dfu.buf + 12) ==
+		    ath3k_rampatch_crc32(dfu.buf + FW_HDR_SIZE,
+		    dfu.len - FW_HDR_SIZE), "%s: CRC doesn't match", name);
+
+		/* The patch, plus the 0xff after the trailer */
+		plen = dfu.len - FW_HDR_SIZE - ATH3K_RAMPATCH_PAD + 1;
+		txt = malloc(64 + 2 * plen);
+		if (txt == NULL)
+			err(1, "malloc");
+		n = sprintf(txt, "DA:%08x\n%zx\n", get32(dfu.buf), plen);
+		for (i = 0; i < plen - 1; i++)
+			n += sprintf(txt + n, "%02x",
+			    dfu.buf[FW_HDR_SIZE + ATH3K_RAMPATCH_PAD + i]);
+		n += sprintf(txt + n, "ff\r\n");
+		if (! write_file(tmpname, txt, n))
+			err(1, "%s", tmpname);
+		free(txt);
+
+		if (ath3k_rampatch_read(&fw, tmpname) <= 0) {
+			CHECK(0, "%s: decode failed", name);
+		} else {
+			CHECK(fw.len == dfu.len &&
+			    memcmp(fw.buf, dfu.buf, dfu.len) == 0,
+			    "%s: decoded image differs", name);
+			ath3k_fw_free(&fw);
+		}
+		ath3k_fw_free(&dfu);
+	}
+
+	if (found == 0)
+		printf("no AthrBT_0x*.dfu under %s; round trip skipped\n",
+		    fwdir);
+}
+
+static void
+test_edges(const char *tmpname)
+{
+	struct ath3k_firmware fw;
+	static const char noda[] = "4\n0011ff22\n";
+	static const char zeroda[] = "DA:0\n4\n0011ff22\n";
+	/* Ends in 0xff but there's no version trailer in front */
+	static const char notrailer[] = "DA:00594000\n4\n001122ff\n";
+
+	write_file(tmpname, noda, sizeof(noda) - 1);
+	CHECK(ath3k_rampatch_read(&fw, tmpname) == 0,
+	    "no download address accepted");
+
+	write_file(tmpname, zeroda, sizeof(zeroda) - 1);
+	CHECK(ath3k_rampatch_read(&fw, tmpname) == 0,
+	    "zero download address accepted");
+
+	write_file(tmpname, notrailer, sizeof(notrailer) - 1);
+	if (ath3k_rampatch_read(&fw, tmpname) <= 0) {
+		CHECK(0, "short patch refused");
+		return;
+	}
+	CHECK(fw.len == FW_HDR_SIZE + ATH3K_RAMPATCH_PAD + 4 &&
+	    fw.buf[fw.len - 1] == 0xff, "trailing 0xff dropped");
+	CHECK(get32(fw.buf + 4) == 0xff221100, "second address word wrong");
+	ath3k_fw_free(&fw);
+}
+
+/*
+ * Count the files in a directory, and name the last one; with
+ * unlink set, remove them instead.
+ */
+static int
+scan_dir(const char *dir, char *name, size_t len, int unlink_them)
+{
+	struct dirent *de;
+	DIR *d;
+	int n = 0;
+
+	d = opendir(dir);
+	if (d == NULL)
+		err(1, "%s", dir);
+	while ((de = readdir(d)) != NULL) {
+		if (de->d_name[0] == '.')
+			continue;
+		snprintf(name, len, "%s/%s", dir, de->d_name);
+		if (unlink_them)
+			unlink(name);
+		n++;
+	}
+	closedir(d);
+	return (n);
+}
+
+static void
+test_ps_cache(const char *tmpname)
+{
+	struct ath3k_firmware fw, fw2;
+	char dir[] = "/tmp/ath3k_ps_cache.XXXXXX", name[FILENAME_MAX];
+	static const char pst[] =
+	    "// test\n#\n[H:S]0013\n[H:S]0004\n[H:A]01 02 03 04\n"
+	    "#\n[H:S]0001\n[H:S]0006\n00 11 22 33 44 55\n";
+
+	if (mkdtemp(dir) == NULL)
+		err(1, "mkdtemp");
+	ath3k_ps_cache_dir = dir;
+	write_file(tmpname, pst, sizeof(pst) - 1);
+
+	if (ath3k_ps_load(&fw, tmpname, 0x01020200) == 0) {
+		CHECK(0, "test .pst didn't compile");
+		goto out;
+	}
+	CHECK(scan_dir(dir, name, sizeof(name), 0) == 1,
+	    "compiled image wasn't cached");
+
+	/* Served from the cache; mark it to tell */
+	fw.buf[fw.len - 1] ^= 0xff;
+	write_file(name, (const char *) fw.buf, fw.len);
+	CHECK(ath3k_ps_load(&fw2, tmpname, 0x01020200) == 1 &&
+	    fw2.len == fw.len && memcmp(fw2.buf, fw.buf, fw.len) == 0,
+	    "cached image not used");
+	ath3k_fw_free(&fw2);
+	fw.buf[fw.len - 1] ^= 0xff;
+
+	/* A damaged one is compiled over */
+	write_file(name, "junk", 4);
+	CHECK(ath3k_ps_load(&fw2, tmpname, 0x01020200) == 1 &&
+	    fw2.len == fw.len && memcmp(fw2.buf, fw.buf, fw.len) == 0,
+	    "damaged cache file used");
+	ath3k_fw_free(&fw2);
+	CHECK(ath3k_fw_read(&fw2, name) == 1 && fw2.len == fw.len,
+	    "damaged cache file not replaced");
+	ath3k_fw_free(&fw2);
+
+	/* Keyed on the load address too */
+	CHECK(ath3k_ps_load(&fw2, tmpname, 0x01020001) == 1 &&
+	    get32(fw2.buf) == 0x00591800, "second ROM didn't compile");
+	ath3k_fw_free(&fw2);
+	CHECK(scan_dir(dir, name, sizeof(name), 0) == 2,
+	    "not one image per load address");
+	ath3k_fw_free(&fw);
+
+out:
+	ath3k_ps_cache_dir = NULL;
+	scan_dir(dir, name, sizeof(name), 1);
+	rmdir(dir);
+}
+
+int
+main(int argc, char *argv[])
+{
+	char tmpname[] = "/tmp/ath3k_rampatch_test.XXXXXX";
+	const char *fwdir;
+	int fd;
+
+	fwdir = getenv("ATH3K_FWDIR");
+	if (fwdir == NULL)
+		fwdir = ath3k_test_fwdir;
+
+	fd = mkstemp(tmpname);
+	if (fd < 0)
+		err(1, "mkstemp");
+	close(fd);
+
+	srandom(1);
+	test_decode_equiv();
+	test_roundtrip(fwdir, tmpname);
+	test_edges(tmpname);
+	test_ps_cache(tmpname);
+
+	unlink(tmpname);
+	if (nfail != 0) {
+		printf("%d checks failed\n", nfail);
+		return (1);
+	}
+	return (0);
+}